@@ -7,6 +7,7 @@
 #include "Internal.h"
 #include "AllFormats.h"
 #include "Bitstream.h"
+#include "RewindableInputStream.h"
 
 // Include files for the formats go here
 #include "Loaders/HeaderlessLoader.h"
@@ -41,21 +42,47 @@ bool elBlockLoaderSelector::Initialize(std::istream* Input)
         return false;
     }
 
+    // An input that can't seek keeps what the loaders look at, so that they can go back over it
+    elRewindableInputStream* Rewindable = dynamic_cast<elRewindableInputStream*>(Input);
+    if (Rewindable)
+    {
+        Rewindable->Mark();
+    }
+
     const std::streamoff StartOffset = Input->tellg();
 
+    // Read the start of the input once, so that most loaders can be ruled out without touching it
+    uint8_t Header[LOADER_SNIFF_SIZE];
+    Input->read((char*)Header, sizeof(Header));
+    const unsigned int HeaderSize = Input->gcount();
+
     // Go through each of the items in the list and look for one that can load this
+    bool Found = false;
     for (fsFormatList::iterator Iter = SelectorList().begin();
         Iter != SelectorList().end(); ++Iter)
     {
+        if (!(*Iter)->Sniff(Header, HeaderSize, StartOffset))
+        {
+            VERBOSE("L: " << (*Iter)->GetName() << " loader ruled out by the header");
+            continue;
+        }
+
         Input->clear();
         Input->seekg(StartOffset);
         if ((*Iter)->Initialize(Input))
         {
             SetSelectorUsed(*Iter);
-            return true;
+            Found = true;
+            break;
         }
     }
-    return false;
+
+    // The blocks are only read forwards from here
+    if (Rewindable)
+    {
+        Rewindable->Release();
+    }
+    return Found;
 }
 
 const std::string elBlockLoaderSelector::GetName() const
@@ -73,6 +100,11 @@ unsigned int elBlockLoaderSelector::GetCurrentBlockIndex()
     return SU()->GetCurrentBlockIndex();
 }
 
+bool elBlockLoaderSelector::SeekToBlock(std::streamoff Offset, unsigned int Index)
+{
+    return SU()->SeekToBlock(Offset, Index);
+}
+
 shared_ptr<elParser> elBlockLoaderSelector::CreateParser() const
 {
     return SU()->CreateParser();
@@ -94,22 +126,58 @@ elParserSelector::~elParserSelector()
     return;
 }
 
-bool elParserSelector::Initialize(bsBitstream& IS)
+unsigned int elParserSelector::Probe(bsBitstream& IS, unsigned int MaxGranules)
 {
     const unsigned long StartOffset = IS.Tell();
+    fsFormat Best;
+    unsigned int BestScore = 0;
+    unsigned int RunnerUpScore = 0;
+    m_RunnerUp.reset();
 
-    // Go through each of the items in the list and look for one that can load this
+    // Go through each of the items in the list and keep the two that read the most
     for (fsFormatList::iterator Iter = SelectorList().begin();
         Iter != SelectorList().end(); ++Iter)
     {
         IS.SeekAbsolute(StartOffset);
-        if ((*Iter)->Initialize(IS))
+        const unsigned int Score = (*Iter)->Probe(IS, MaxGranules);
+        if (Score > BestScore)
         {
-            SetSelectorUsed(*Iter);
-            return true;
+            m_RunnerUp = Best;
+            RunnerUpScore = BestScore;
+            Best = *Iter;
+            BestScore = Score;
+        }
+        else if (Score > RunnerUpScore)
+        {
+            m_RunnerUp = *Iter;
+            RunnerUpScore = Score;
+        }
+
+        // Nothing can beat those
+        if (RunnerUpScore == MaxGranules)
+        {
+            break;
         }
     }
-    return false;
+
+    if (Best)
+    {
+        SetSelectorUsed(Best);
+    }
+    IS.SeekAbsolute(StartOffset);
+    return BestScore;
+}
+
+bool elParserSelector::UseRunnerUp()
+{
+    if (!m_RunnerUp)
+    {
+        return false;
+    }
+    VERBOSE("P: falling back to " << m_RunnerUp->GetName());
+    SetSelectorUsed(m_RunnerUp);
+    m_RunnerUp.reset();
+    return true;
 }
 
 const std::string elParserSelector::GetName() const
@@ -117,7 +185,12 @@ const std::string elParserSelector::GetName() const
     return SU()->GetName();
 }
 
-void elParserSelector::Parse(elStreamVector& Streams, bsBitstream& IS)
+shared_ptr<elParser> elParserSelector::Clone() const
+{
+    return SU()->Clone();
+}
+
+void elParserSelector::Parse(elStreamVector& Streams, bsBitstream& IS, const shared_array<uint8_t>& BlockData)
 {
-    return SU()->Parse(Streams, IS);
+    return SU()->Parse(Streams, IS, BlockData);
 }
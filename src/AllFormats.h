@@ -32,6 +32,9 @@ public:
     /// Gets the current block index.
     virtual unsigned int GetCurrentBlockIndex();
 
+    /// Makes the next ReadNextBlock() read the block at Offset.
+    virtual bool SeekToBlock(std::streamoff Offset, unsigned int Index);
+
     /// Creates an EALayer3 parser for this particular file.
     virtual shared_ptr<elParser> CreateParser() const;
 
@@ -46,12 +49,22 @@ public:
     elParserSelector();
     virtual ~elParserSelector();
 
-    /// Parses the entire input stream and checks to see if it's a format that can be parsed.
-    virtual bool Initialize(bsBitstream& IS);
+    /// Probes the input stream with each of the parsers and uses the one with the best score.
+    /// Ties go to the parser that was added first.
+    virtual unsigned int Probe(bsBitstream& IS, unsigned int MaxGranules = 8);
+
+    /// Switch to the parser with the second best score from Probe(), if any read a granule.
+    virtual bool UseRunnerUp();
 
     /// Get the name associated with this parser.
     virtual const std::string GetName() const;
+
+    /// Make another parser of the kind that is being used.
+    virtual shared_ptr<elParser> Clone() const;
     
     /// Parses the entire input stream and outputs an elStreamVector.
-    virtual void Parse(elStreamVector& Streams, bsBitstream& IS);
+    virtual void Parse(elStreamVector& Streams, bsBitstream& IS, const shared_array<uint8_t>& BlockData);
+
+protected:
+    fsFormat m_RunnerUp;
 };
@@ -0,0 +1,167 @@
+/*
+ *  EA Layer 3 Extractor/Decoder
+ *  Copyright (C) 2011, Ben Moench.
+ *  See License.txt
+ */
+
+#include "Internal.h"
+#include "BatchDecoder.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace fs = boost::filesystem;
+
+
+elBatchDecoder::elBatchDecoder(const elFileDecoder& settings) :
+    settings(settings),
+    threads(0),
+    nextInput(0),
+    failures(0),
+    decodeThreads(1)
+{
+    return;
+}
+
+
+elBatchDecoder::~elBatchDecoder()
+{
+    return;
+}
+
+
+void elBatchDecoder::AddInput(const std::string& path)
+{
+    if (!IsDirectory(path))
+    {
+        inputs.push_back(path);
+        return;
+    }
+    
+    // Walk the directory, sorting the files so the order is always the same
+    std::vector<std::string> found;
+    for (fs::recursive_directory_iterator iter(path), end; iter != end; ++iter)
+    {
+        if (!fs::is_regular_file(iter->status()))
+        {
+            continue;
+        }
+        
+        std::string ext = iter->path().extension().string();
+        for (unsigned int i = 0; i < ext.length(); i++)
+        {
+            ext[i] = tolower(ext[i]);
+        }
+        if (ext == ".mp3" || ext == ".wav" || ext == ".idx")
+        {
+            continue;
+        }
+        
+        found.push_back(iter->path().string());
+    }
+    
+    std::sort(found.begin(), found.end());
+    inputs.insert(inputs.end(), found.begin(), found.end());
+    return;
+}
+
+
+unsigned int elBatchDecoder::GetInputCount() const
+{
+    return inputs.size();
+}
+
+
+void elBatchDecoder::SetThreads(unsigned int threads)
+{
+    this->threads = threads;
+    return;
+}
+
+
+unsigned int elBatchDecoder::GetThreads() const
+{
+    return this->threads;
+}
+
+
+unsigned int elBatchDecoder::Process()
+{
+    nextInput = 0;
+    failures = 0;
+    
+    unsigned int total = threads;
+    if (total == 0)
+    {
+        total = boost::thread::hardware_concurrency();
+    }
+    const unsigned int count = std::max(1u, std::min(total, (unsigned int) inputs.size()));
+    
+    // Threads that no file needs go to decoding the files themselves
+    decodeThreads = std::max(1u, total / count);
+    
+    VERBOSE("Decoding " << inputs.size() << " files with " << count << " threads");
+    
+    boost::thread_group workers;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        workers.create_thread(boost::bind(&elBatchDecoder::Worker, this));
+    }
+    workers.join_all();
+    
+    return failures;
+}
+
+
+bool elBatchDecoder::IsDirectory(const std::string& path)
+{
+    boost::system::error_code error;
+    return fs::is_directory(path, error);
+}
+
+
+void elBatchDecoder::Worker()
+{
+    while (true)
+    {
+        std::string filename;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (nextInput >= inputs.size())
+            {
+                return;
+            }
+            filename = inputs[nextInput++];
+        }
+        
+        std::string error;
+        try
+        {
+            elFileDecoder decoder(settings);
+            decoder.SetInput(filename, settings.GetInputOffset());
+            decoder.SetDecodeThreads(decodeThreads);
+            decoder.Process();
+        }
+        catch (std::exception& E)
+        {
+            error = E.what();
+        }
+        catch (...)
+        {
+            error = "Crashed.";
+        }
+        
+        boost::mutex::scoped_lock lock(mutex);
+        if (error.empty())
+        {
+            VERBOSE("Decoded '" << filename << "'");
+        }
+        else
+        {
+            std::cerr << filename << ": " << error << std::endl;
+            failures++;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ *  EA Layer 3 Extractor/Decoder
+ *  Copyright (C) 2011, Ben Moench.
+ *  See License.txt
+ */
+
+#pragma once
+
+#include "Internal.h"
+#include "FileDecoder.h"
+
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Decodes many files with a pool of worker threads. Every file gets its own
+ * elFileDecoder, set up like the one given to the constructor, and the output
+ * files are named after the input files.
+ */
+class elBatchDecoder
+{
+public:
+    
+    elBatchDecoder(const elFileDecoder& settings);
+    ~elBatchDecoder();
+    
+    /**
+     * Add a file, or all of the files under a directory. Files that look like
+     * our own output (.mp3 and .wav) are skipped in directories.
+     */
+    void AddInput(const std::string& path);
+    
+    /**
+     * Get the number of files that will be decoded.
+     */
+    unsigned int GetInputCount() const;
+    
+    /**
+     * Set the number of worker threads. Use 0 for one per processor. When
+     * there are fewer files than threads, each file is decoded on several.
+     */
+    void SetThreads(unsigned int threads);
+    
+    unsigned int GetThreads() const;
+    
+    /**
+     * Decode all of the files. Errors are written to std::cerr and don't stop
+     * the other files. Returns the number of files that failed.
+     */
+    unsigned int Process();
+    
+    /**
+     * Is the path a directory?
+     */
+    static bool IsDirectory(const std::string& path);
+    
+    
+private:
+    elFileDecoder settings;
+    std::vector<std::string> inputs;
+    unsigned int threads;
+    
+private:
+    boost::mutex mutex;
+    unsigned int nextInput;
+    unsigned int failures;
+    unsigned int decodeThreads;
+    
+    void Worker();
+};
@@ -482,3 +482,387 @@ protected:
     uint32_t m_BitBuffer;
     unsigned int m_BitBufferUsed;
 };
+
+
+/// Load 8 bytes as a big endian number. Compilers turn this into one load and a byte swap.
+inline uint64_t bsLoad64BE(const uint8_t* Data)
+{
+    return uint64_t(Data[0]) << 56 | uint64_t(Data[1]) << 48 |
+        uint64_t(Data[2]) << 40 | uint64_t(Data[3]) << 32 |
+        uint64_t(Data[4]) << 24 | uint64_t(Data[5]) << 16 |
+        uint64_t(Data[6]) << 8 | uint64_t(Data[7]);
+}
+
+
+/**
+ * A read-only bitstream for parsing lots of small fields. The bits are kept in a
+ * 64-bit cache that is refilled with a single load, so a read is a shift and a mask.
+ * Reads are not clamped to the end of the data; bits past the end read as zero, so
+ * check GetCountBitsLeft() once before parsing a run of fields.
+ */
+class bsBitReader
+{
+public:
+    inline bsBitReader(const uint8_t* Data, unsigned long SizeInBytes, unsigned long BitOffset = 0) :
+        m_Data(Data),
+        m_Size(SizeInBytes),
+        m_Next(0),
+        m_Cache(0),
+        m_CacheBits(0)
+    {
+        assert(Data);
+        SeekAbsolute(BitOffset);
+        return;
+    }
+
+    /// Start reading where IS is. IS isn't moved, use IS.SeekAbsolute(Tell()) when done.
+    inline explicit bsBitReader(const bsBitstream& IS) :
+        m_Data(IS.GetData()),
+        m_Size(IS.GetSizeInBytes()),
+        m_Next(0),
+        m_Cache(0),
+        m_CacheBits(0)
+    {
+        assert(m_Data);
+        SeekAbsolute(IS.Tell());
+        return;
+    }
+
+    /// Get the next Count bits (1 to 32) without moving past them.
+    inline unsigned int PeekBits(unsigned int Count)
+    {
+        assert(Count > 0 && Count <= 32);
+
+        if (m_CacheBits < Count)
+        {
+            FillCache();
+        }
+        return static_cast<unsigned int>(m_Cache >> (64 - Count));
+    }
+
+    /// Move past Count bits.
+    inline void SkipBits(unsigned long Count)
+    {
+        if (Count <= m_CacheBits)
+        {
+            m_Cache <<= Count;
+            m_CacheBits -= Count;
+        }
+        else
+        {
+            SeekAbsolute(Tell() + Count);
+        }
+        return;
+    }
+
+    inline unsigned int ReadBits(unsigned int Count)
+    {
+        const unsigned int Bits = PeekBits(Count);
+        m_Cache <<= Count;
+        m_CacheBits -= Count;
+        return Bits;
+    }
+
+    inline unsigned int ReadBit()
+    {
+        return ReadBits(1);
+    }
+
+    inline void SeekAbsolute(unsigned long NewOffset)
+    {
+        m_Next = NewOffset / 8;
+        m_Cache = 0;
+        m_CacheBits = 0;
+        FillCache();
+
+        m_Cache <<= NewOffset % 8;
+        m_CacheBits -= NewOffset % 8;
+        return;
+    }
+
+    /// The position in bits. This can be past the end if bits past the end were read.
+    inline unsigned long Tell() const
+    {
+        return m_Next * 8 - m_CacheBits;
+    }
+
+    inline unsigned long GetCountBitsLeft() const
+    {
+        const unsigned long Position = Tell();
+        return Position < m_Size * 8 ? m_Size * 8 - Position : 0;
+    }
+
+protected:
+    /// Top the cache up to at least 56 bits.
+    inline void FillCache()
+    {
+        if (m_Next + 8 <= m_Size)
+        {
+            // Load the next 8 bytes at once and only count the whole bytes that fit,
+            // the rest of the bits will be loaded again in the same place next time
+            m_Cache |= bsLoad64BE(m_Data + m_Next) >> m_CacheBits;
+            m_Next += (63 - m_CacheBits) / 8;
+            m_CacheBits |= 56;
+        }
+        else
+        {
+            // Near the end, go a byte at a time and read zeros past it
+            while (m_CacheBits <= 56)
+            {
+                const uint64_t Byte = m_Next < m_Size ? m_Data[m_Next] : 0;
+                m_Cache |= Byte << (56 - m_CacheBits);
+                m_CacheBits += 8;
+                m_Next++;
+            }
+        }
+        return;
+    }
+
+    const uint8_t* m_Data;
+    unsigned long m_Size;
+    unsigned long m_Next;
+
+    uint64_t m_Cache;
+    unsigned int m_CacheBits;
+};
+
+
+/// Store a number as 4 big endian bytes.
+inline void bsStore32BE(uint8_t* Data, uint32_t Value)
+{
+    Data[0] = uint8_t(Value >> 24);
+    Data[1] = uint8_t(Value >> 16);
+    Data[2] = uint8_t(Value >> 8);
+    Data[3] = uint8_t(Value);
+    return;
+}
+
+
+/// Store a number as 8 big endian bytes.
+inline void bsStore64BE(uint8_t* Data, uint64_t Value)
+{
+    bsStore32BE(Data, uint32_t(Value >> 32));
+    bsStore32BE(Data + 4, uint32_t(Value));
+    return;
+}
+
+
+/// Get Count bits (1 to 8) starting Offset bits (0 to 7) into Src. Src[1] is only read if needed.
+inline unsigned int bsGetSmallBits(const uint8_t* Src, unsigned int Offset, unsigned int Count)
+{
+    assert(Offset < 8 && Count > 0 && Count <= 8);
+
+    unsigned int Window = Src[0] << 8;
+    if (Offset + Count > 8)
+    {
+        Window |= Src[1];
+    }
+    return (Window >> (16 - Offset - Count)) & BITMASK(Count);
+}
+
+
+/// Put Count bits (1 to 8) Offset bits (0 to 7) into Dst, keeping the rest of the byte.
+inline void bsPutSmallBits(uint8_t* Dst, unsigned int Offset, unsigned int Bits, unsigned int Count)
+{
+    assert(Offset + Count <= 8);
+
+    const unsigned int Shift = 8 - Offset - Count;
+    const unsigned int Mask = BITMASK(Count) << Shift;
+    Dst[0] = uint8_t((Dst[0] & ~Mask) | ((Bits << Shift) & Mask));
+    return;
+}
+
+
+/**
+ * Copy Count bits from Src to Dst, at any bit offsets. The bits around the
+ * destination range are kept, and no source bytes outside the range are read.
+ * It comes down to a memcpy() when the offsets line up on the same bit, and
+ * to 64 bits at a time otherwise.
+ */
+inline void bsCopyBits(uint8_t* Dst, unsigned long DstBitOffset, const uint8_t* Src, unsigned long SrcBitOffset, unsigned long Count)
+{
+    if (!Count)
+    {
+        return;
+    }
+
+    Dst += DstBitOffset / 8;
+    Src += SrcBitOffset / 8;
+    unsigned int DstBitsInto = DstBitOffset % 8;
+    unsigned int SrcBitsInto = SrcBitOffset % 8;
+
+    // Fill up the first destination byte so that the rest are whole bytes
+    if (DstBitsInto)
+    {
+        const unsigned int Bits = min(8 - DstBitsInto, Count);
+        bsPutSmallBits(Dst, DstBitsInto, bsGetSmallBits(Src, SrcBitsInto, Bits), Bits);
+
+        Count -= Bits;
+        Dst++;
+        SrcBitsInto += Bits;
+        Src += SrcBitsInto / 8;
+        SrcBitsInto %= 8;
+    }
+
+    // The whole bytes
+    const unsigned long Bytes = Count / 8;
+    if (!SrcBitsInto)
+    {
+        memcpy(Dst, Src, Bytes);
+    }
+    else
+    {
+        const unsigned int Shift = SrcBitsInto;
+        unsigned long i = 0;
+
+        for (; i + 8 <= Bytes; i += 8)
+        {
+            bsStore64BE(Dst + i, bsLoad64BE(Src + i) << Shift | Src[i + 8] >> (8 - Shift));
+        }
+        for (; i < Bytes; i++)
+        {
+            Dst[i] = uint8_t(Src[i] << Shift | Src[i + 1] >> (8 - Shift));
+        }
+    }
+
+    // The bits left over
+    Count %= 8;
+    if (Count)
+    {
+        bsPutSmallBits(Dst + Bytes, 0, bsGetSmallBits(Src + Bytes, SrcBitsInto, Count), Count);
+    }
+    return;
+}
+
+
+/**
+ * A write-only bitstream for writing lots of small fields. The bits are collected
+ * in a 64-bit register and stored 32 bits at a time. Flush() must be called before
+ * the data is used; writing can carry on after it. Bits before the starting offset
+ * and after the last bit written are kept.
+ */
+class bsBitWriter
+{
+public:
+    inline bsBitWriter(uint8_t* Data, unsigned long SizeInBytes, unsigned long BitOffset = 0) :
+        m_Data(Data),
+        m_Size(SizeInBytes),
+        m_Next(0),
+        m_Acc(0),
+        m_AccBits(0)
+    {
+        assert(Data);
+        Start(BitOffset);
+        return;
+    }
+
+    /// Start writing where OS is. OS isn't moved, use OS.SeekAbsolute(Tell()) after Flush().
+    inline explicit bsBitWriter(bsBitstream& OS) :
+        m_Data(OS.GetData()),
+        m_Size(OS.GetSizeInBytes()),
+        m_Next(0),
+        m_Acc(0),
+        m_AccBits(0)
+    {
+        assert(m_Data);
+        Start(OS.Tell());
+        return;
+    }
+
+    /// Write the low Count bits (0 to 32) of Bits.
+    inline void WriteBits(unsigned int Bits, unsigned int Count)
+    {
+        assert(Count <= 32);
+        assert(m_AccBits < 32);
+
+        // Shifting in two steps drops the unused high bits and handles a Count of 0
+        m_Acc |= ((uint64_t(Bits) << 32) << (32 - Count)) >> m_AccBits;
+        m_AccBits += Count;
+
+        if (m_AccBits >= 32)
+        {
+            assert(m_Next + 4 <= m_Size);
+
+            bsStore32BE(m_Data + m_Next, uint32_t(m_Acc >> 32));
+            m_Next += 4;
+            m_Acc <<= 32;
+            m_AccBits -= 32;
+        }
+        return;
+    }
+
+    inline void WriteBit(unsigned int Bit)
+    {
+        WriteBits(Bit, 1);
+        return;
+    }
+
+    /// Pad with zeros to the next byte boundary.
+    inline void WriteToNextByte()
+    {
+        if (m_AccBits % 8)
+        {
+            WriteBits(0, 8 - m_AccBits % 8);
+        }
+        return;
+    }
+
+    /// Copy Count bits from Src, starting SrcBitOffset bits in.
+    inline void CopyBits(const uint8_t* Src, unsigned long SrcBitOffset, unsigned long Count)
+    {
+        const unsigned long Position = Tell();
+        assert(Position + Count <= m_Size * 8);
+
+        Flush();
+        bsCopyBits(m_Data, Position, Src, SrcBitOffset, Count);
+        Start(Position + Count);
+        return;
+    }
+
+    /// Store the bits that are still in the register.
+    inline void Flush()
+    {
+        const unsigned int Bytes = m_AccBits / 8;
+        const unsigned int BitsInto = m_AccBits % 8;
+        assert(m_Next + Bytes + (BitsInto ? 1 : 0) <= m_Size);
+
+        for (unsigned int i = 0; i < Bytes; i++)
+        {
+            m_Data[m_Next + i] = uint8_t(m_Acc >> (56 - i * 8));
+        }
+        if (BitsInto)
+        {
+            const uint8_t Keep = m_Data[m_Next + Bytes] & (0xFF >> BitsInto);
+            m_Data[m_Next + Bytes] = uint8_t(m_Acc >> (56 - Bytes * 8)) | Keep;
+        }
+        return;
+    }
+
+    inline unsigned long Tell() const
+    {
+        return m_Next * 8 + m_AccBits;
+    }
+
+protected:
+    inline void Start(unsigned long BitOffset)
+    {
+        assert(BitOffset <= m_Size * 8);
+
+        // Pick up the bits of the first byte that come before the offset
+        m_Next = BitOffset / 8;
+        m_AccBits = BitOffset % 8;
+        m_Acc = 0;
+        if (m_AccBits)
+        {
+            m_Acc = uint64_t(m_Data[m_Next] >> (8 - m_AccBits)) << (64 - m_AccBits);
+        }
+        return;
+    }
+
+    uint8_t* m_Data;
+    unsigned long m_Size;
+    unsigned long m_Next;
+
+    uint64_t m_Acc;
+    unsigned int m_AccBits;
+};
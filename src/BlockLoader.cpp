@@ -7,6 +7,7 @@
 #include "Internal.h"
 #include "BlockLoader.h"
 #include "Parser.h"
+#include "MappedInputStream.h"
 
 elBlock::elBlock() :
         Size(0),
@@ -56,6 +57,23 @@ bool elBlockLoader::Initialize(std::istream* Input)
     return true;
 }
 
+bool elBlockLoader::Sniff(const uint8_t* /*Header*/, unsigned int /*Size*/, std::streamoff /*Offset*/) const
+{
+    return true;
+}
+
+bool elBlockLoader::SeekToBlock(std::streamoff Offset, unsigned int Index)
+{
+    if (!m_Input)
+    {
+        return false;
+    }
+    m_Input->clear();
+    m_Input->seekg(Offset);
+    m_CurrentBlockIndex = Index;
+    return m_Input->good();
+}
+
 unsigned int elBlockLoader::GetCurrentBlockIndex()
 {
     return m_CurrentBlockIndex;
@@ -70,3 +88,25 @@ void elBlockLoader::ListSupportedParsers(std::vector<std::string>& Names) const
 {
     return;
 }
+
+shared_array<uint8_t> elBlockLoader::ReadBlockData(unsigned int Size)
+{
+    assert(m_Input);
+
+    // Share the mapping if the whole block is in the file, otherwise read it the
+    // normal way so that the stream ends up in the same state
+    const elMappedInputStream* Mapped = dynamic_cast<const elMappedInputStream*>(m_Input);
+    if (Mapped && m_Input->good())
+    {
+        shared_array<uint8_t> Data = Mapped->Share(m_Input->tellg(), Size);
+        if (Data)
+        {
+            m_Input->seekg(Size, std::ios_base::cur);
+            return Data;
+        }
+    }
+
+    shared_array<uint8_t> Data(new uint8_t[Size]);
+    m_Input->read((char*)Data.get(), Size);
+    return Data;
+}
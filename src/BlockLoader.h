@@ -8,6 +8,9 @@
 
 #include "Internal.h"
 
+/// How much of the input elBlockLoaderSelector reads up front to pick a loader.
+#define LOADER_SNIFF_SIZE 64
+
 class elBlock
 {
 public:
@@ -39,12 +42,22 @@ public:
     /// Initializes the loader, returning false if this file cannot be read by this loader.
     virtual bool Initialize(std::istream* Input);
 
+    /// Looks at the first Size bytes of the input, which start at Offset, and returns false if
+    /// they rule this format out. Initialize() is only tried when this returns true, so it must
+    /// not reject anything that Initialize() would accept. Size can be less than LOADER_SNIFF_SIZE
+    /// for short files.
+    virtual bool Sniff(const uint8_t* Header, unsigned int Size, std::streamoff Offset) const;
+
     /// Reads the next block from the file and updates the current block index.
     virtual bool ReadNextBlock(elBlock& Block) = 0;
 
     /// Gets the current block index.
     virtual unsigned int GetCurrentBlockIndex();
 
+    /// Makes the next ReadNextBlock() read the block at Offset, which has the index Index.
+    /// Offset must be the elBlock::Offset of a block this loader has read before from the same input.
+    virtual bool SeekToBlock(std::streamoff Offset, unsigned int Index);
+
     /// Creates an EALayer3 parser for this particular file.
     virtual shared_ptr<elParser> CreateParser() const;
 
@@ -52,11 +65,25 @@ public:
     virtual void ListSupportedParsers(std::vector<std::string>& Names) const;
 
 protected:
+    /// Read Size bytes of block data from the input. If the input is memory mapped
+    /// the data points into the mapping instead of being copied.
+    shared_array<uint8_t> ReadBlockData(unsigned int Size);
+
     std::istream* m_Input;
     unsigned int m_CurrentBlockIndex;
 };
 
 
+inline uint16_t Load16BE(const uint8_t* Ptr)
+{
+    return (uint16_t)(Ptr[0] << 8 | Ptr[1]);
+}
+
+inline uint32_t Load32BE(const uint8_t* Ptr)
+{
+    return (uint32_t)Ptr[0] << 24 | (uint32_t)Ptr[1] << 16 | (uint32_t)Ptr[2] << 8 | Ptr[3];
+}
+
 inline void Swap(uint16_t& Value)
 {
     Value = (Value & 0xFF00) >> 8 | (Value & 0x00FF) << 8;
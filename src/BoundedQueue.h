@@ -0,0 +1,178 @@
+/*
+ *  EA Layer 3 Extractor/Decoder
+ *  Copyright (C) 2011, Ben Moench.
+ *  See License.txt
+ */
+
+#pragma once
+
+#include "Internal.h"
+
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * How a queue was used, for finding out which side of it is the slow one.
+ */
+struct elQueueStats
+{
+    elQueueStats() : Pushes(0), DepthTotal(0), MaxDepth(0),
+        FullWaits(0), EmptyWaits(0) {};
+
+    unsigned long Pushes;
+    unsigned long DepthTotal;
+    unsigned int MaxDepth;
+
+    /// How many times the producer had to wait for room.
+    unsigned long FullWaits;
+
+    /// How many times the consumer had to wait for an item.
+    unsigned long EmptyWaits;
+
+    /// The average number of items in the queue just after a push.
+    double GetAverageDepth() const
+    {
+        return Pushes ? (double) DepthTotal / Pushes : 0.0;
+    }
+};
+
+/**
+ * A queue for handing items from one thread to exactly one other thread.
+ * Items go through a lock-free ring buffer, and the mutex is only taken when
+ * a side has to sleep because the queue is full or empty. Push() blocks while
+ * the queue is full so a fast producer can't run away from a slow consumer.
+ * Either side can Close() the queue to make the other one stop waiting.
+ */
+template <typename T>
+class elBoundedQueue
+{
+public:
+    elBoundedQueue(unsigned int capacity) :
+        queue(capacity),
+        capacity(capacity),
+        closed(false),
+        sleepers(0)
+    {
+        return;
+    }
+
+    /**
+     * Add an item, waiting for room. Returns false if the queue was closed.
+     * Only call this from the producer thread.
+     */
+    bool Push(const T& item)
+    {
+        while (!closed.load(boost::memory_order_acquire))
+        {
+            if (queue.push(item))
+            {
+                const unsigned int depth = capacity - queue.write_available();
+                stats.Pushes++;
+                stats.DepthTotal += depth;
+                stats.MaxDepth = std::max(stats.MaxDepth, depth);
+
+                Wake();
+                return true;
+            }
+
+            stats.FullWaits++;
+            Sleep(true);
+        }
+        return false;
+    }
+
+    /**
+     * Take the oldest item, waiting for one. Returns false once the queue is
+     * closed and everything in it has been taken. Only call this from the
+     * consumer thread.
+     */
+    bool Pop(T& item)
+    {
+        while (true)
+        {
+            if (queue.pop(item))
+            {
+                Wake();
+                return true;
+            }
+            if (closed.load(boost::memory_order_acquire))
+            {
+                // Something may have been pushed just before it was closed
+                return queue.pop(item);
+            }
+
+            stats.EmptyWaits++;
+            Sleep(false);
+        }
+    }
+
+    /**
+     * Stop accepting items and wake up anyone waiting.
+     */
+    void Close()
+    {
+        closed.store(true, boost::memory_order_release);
+
+        boost::mutex::scoped_lock lock(mutex);
+        wakeup.notify_all();
+        return;
+    }
+
+    /**
+     * Get the counters. Only meaningful once both threads are done with the queue.
+     */
+    const elQueueStats& GetStats() const
+    {
+        return stats;
+    }
+
+private:
+    /**
+     * Sleep until the queue has room (for the producer) or has an item (for
+     * the consumer), or it is closed.
+     */
+    void Sleep(bool producer)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        sleepers.fetch_add(1, boost::memory_order_seq_cst);
+
+        // Pairs with the fence in Wake(): either the other side sees us
+        // sleeping, or we see what it just did to the queue
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+        while (!closed.load(boost::memory_order_acquire) &&
+            (producer ? queue.write_available() == 0 : queue.read_available() == 0))
+        {
+            wakeup.wait(lock);
+        }
+
+        sleepers.fetch_sub(1, boost::memory_order_relaxed);
+        return;
+    }
+
+    /**
+     * Wake the other side if it is sleeping.
+     */
+    void Wake()
+    {
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (sleepers.load(boost::memory_order_relaxed) > 0)
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            wakeup.notify_all();
+        }
+        return;
+    }
+
+    boost::lockfree::spsc_queue<T> queue;
+    const unsigned int capacity;
+    boost::atomic<bool> closed;
+    boost::atomic<int> sleepers;
+    elQueueStats stats;
+
+    boost::mutex mutex;
+    boost::condition_variable wakeup;
+};
@@ -0,0 +1,238 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2011, Ben Moench.
+    See License.txt
+*/
+
+#include "Internal.h"
+#include "DecodeIndex.h"
+
+#include <fstream>
+
+/// The first bytes of an index file. The last one is the version of the format.
+static const char IndexSignature[8] = {'E', 'A', 'L', '3', 'I', 'D', 'X', 1};
+
+// The index is always little endian
+
+static void Write32(std::ostream& Output, uint32_t Value)
+{
+    uint8_t Bytes[4];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        Bytes[i] = (uint8_t)(Value >> (i * 8));
+    }
+    Output.write((const char*)Bytes, 4);
+    return;
+}
+
+static void Write64(std::ostream& Output, uint64_t Value)
+{
+    Write32(Output, (uint32_t)Value);
+    Write32(Output, (uint32_t)(Value >> 32));
+    return;
+}
+
+static uint32_t Read32(std::istream& Input)
+{
+    uint8_t Bytes[4] = {0, 0, 0, 0};
+    Input.read((char*)Bytes, 4);
+
+    uint32_t Value = 0;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        Value |= (uint32_t)Bytes[i] << (i * 8);
+    }
+    return Value;
+}
+
+static uint64_t Read64(std::istream& Input)
+{
+    const uint64_t Low = Read32(Input);
+    const uint64_t High = Read32(Input);
+    return Low | High << 32;
+}
+
+
+void elIndexPart::AddBlock(std::streamoff Offset, unsigned int SampleCount,
+    const std::vector<unsigned int>& FirstFrame, const std::vector<unsigned int>& FirstGranule)
+{
+    Blocks.push_back(elIndexBlock());
+    elIndexBlock& Block = Blocks.back();
+    Block.Offset = Offset;
+    Block.FirstSample = this->SampleCount;
+    Block.SampleCount = SampleCount;
+    Block.FirstFrame = FirstFrame;
+    Block.FirstGranule = FirstGranule;
+
+    this->SampleCount += SampleCount;
+    return;
+}
+
+unsigned int elIndexPart::FindBlock(uint64_t Sample) const
+{
+    // Binary search for the last block that starts at or before the sample
+    unsigned int Low = 0;
+    unsigned int High = Blocks.size();
+    while (High - Low > 1)
+    {
+        const unsigned int Middle = Low + (High - Low) / 2;
+        if (Blocks[Middle].FirstSample <= Sample)
+        {
+            Low = Middle;
+        }
+        else
+        {
+            High = Middle;
+        }
+    }
+    return Low;
+}
+
+
+elDecodeIndex::elDecodeIndex() :
+    m_InputSize(0),
+    m_InputTime(0),
+    m_InputOffset(0),
+    m_Settings(0)
+{
+    return;
+}
+
+elDecodeIndex::~elDecodeIndex()
+{
+    return;
+}
+
+void elDecodeIndex::Reset(uint64_t InputSize, int64_t InputTime, std::streamoff InputOffset, unsigned int Settings)
+{
+    m_InputSize = InputSize;
+    m_InputTime = InputTime;
+    m_InputOffset = InputOffset;
+    m_Settings = Settings;
+    m_Parts.clear();
+    return;
+}
+
+bool elDecodeIndex::Matches(uint64_t InputSize, int64_t InputTime, std::streamoff InputOffset, unsigned int Settings) const
+{
+    return m_InputSize == InputSize && m_InputTime == InputTime &&
+        m_InputOffset == InputOffset && m_Settings == Settings;
+}
+
+std::string elDecodeIndex::GetIndexFilename(const std::string& InputFilename)
+{
+    return InputFilename + ".idx";
+}
+
+bool elDecodeIndex::Load(const std::string& Filename)
+{
+    m_Parts.clear();
+
+    std::ifstream Input(Filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!Input.is_open())
+    {
+        return false;
+    }
+
+    char Signature[sizeof(IndexSignature)];
+    Input.read(Signature, sizeof(Signature));
+    if (!Input.good() || memcmp(Signature, IndexSignature, sizeof(Signature)) != 0)
+    {
+        VERBOSE("I: '" << Filename << "' is not an index or has an old format");
+        return false;
+    }
+
+    m_InputSize = Read64(Input);
+    m_InputTime = (int64_t)Read64(Input);
+    m_InputOffset = (int64_t)Read64(Input);
+    m_Settings = Read32(Input);
+
+    const unsigned int PartCount = Read32(Input);
+    for (unsigned int i = 0; i < PartCount && Input.good(); i++)
+    {
+        elIndexPart Part;
+        Part.Offset = (std::streamoff)Read64(Input);
+        Part.StreamCount = Read32(Input);
+        const unsigned int BlockCount = Read32(Input);
+        if (Part.StreamCount > 256)
+        {
+            break;
+        }
+
+        std::vector<unsigned int> FirstFrame(Part.StreamCount);
+        std::vector<unsigned int> FirstGranule(Part.StreamCount);
+        for (unsigned int j = 0; j < BlockCount && Input.good(); j++)
+        {
+            const std::streamoff Offset = (std::streamoff)Read64(Input);
+            const unsigned int SampleCount = Read32(Input);
+            for (unsigned int k = 0; k < Part.StreamCount; k++)
+            {
+                FirstFrame[k] = Read32(Input);
+                FirstGranule[k] = Read32(Input);
+            }
+            Part.AddBlock(Offset, SampleCount, FirstFrame, FirstGranule);
+        }
+        m_Parts.push_back(Part);
+    }
+
+    if (!Input.good() || m_Parts.size() != PartCount)
+    {
+        VERBOSE("I: '" << Filename << "' is damaged");
+        m_Parts.clear();
+        return false;
+    }
+    return true;
+}
+
+bool elDecodeIndex::Save(const std::string& Filename) const
+{
+    std::ofstream Output(Filename.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!Output.is_open())
+    {
+        return false;
+    }
+
+    Output.write(IndexSignature, sizeof(IndexSignature));
+    Write64(Output, m_InputSize);
+    Write64(Output, (uint64_t)m_InputTime);
+    Write64(Output, (uint64_t)m_InputOffset);
+    Write32(Output, m_Settings);
+
+    Write32(Output, m_Parts.size());
+    for (std::vector<elIndexPart>::const_iterator Part = m_Parts.begin();
+        Part != m_Parts.end(); ++Part)
+    {
+        Write64(Output, (uint64_t)Part->Offset);
+        Write32(Output, Part->StreamCount);
+        Write32(Output, Part->Blocks.size());
+
+        for (std::vector<elIndexBlock>::const_iterator Block = Part->Blocks.begin();
+            Block != Part->Blocks.end(); ++Block)
+        {
+            Write64(Output, (uint64_t)Block->Offset);
+            Write32(Output, Block->SampleCount);
+            for (unsigned int k = 0; k < Part->StreamCount; k++)
+            {
+                Write32(Output, Block->FirstFrame[k]);
+                Write32(Output, Block->FirstGranule[k]);
+            }
+        }
+    }
+    return Output.good();
+}
+
+void elDecodeIndex::AddPart(const elIndexPart& Part)
+{
+    m_Parts.push_back(Part);
+    return;
+}
+
+unsigned int elDecodeIndex::GetPartCount() const
+{
+    return m_Parts.size();
+}
+
+const elIndexPart& elDecodeIndex::GetPart(unsigned int Index) const
+{
+    return m_Parts.at(Index);
+}
@@ -0,0 +1,87 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2011, Ben Moench.
+    See License.txt
+*/
+
+#pragma once
+
+#include "Internal.h"
+
+/// Where a block is in the input and where its frames start in the output.
+struct elIndexBlock
+{
+    elIndexBlock() : Offset(0), FirstSample(0), SampleCount(0) {};
+
+    std::streamoff Offset;
+    uint64_t FirstSample;
+    unsigned int SampleCount;
+
+    /// For each stream, the first MP3 frame (not counting the VBR info frame) and the
+    /// first granule that were made from this block.
+    std::vector<unsigned int> FirstFrame;
+    std::vector<unsigned int> FirstGranule;
+};
+
+/// The blocks of one part of the input, as read by elFileDecoder::ProcessPart.
+struct elIndexPart
+{
+    elIndexPart() : Offset(0), StreamCount(0), SampleCount(0) {};
+
+    /// Add a block to the end of the part.
+    void AddBlock(std::streamoff Offset, unsigned int SampleCount,
+        const std::vector<unsigned int>& FirstFrame, const std::vector<unsigned int>& FirstGranule);
+
+    /// Find the block holding sample frame Sample, or the last block if it's past the end.
+    unsigned int FindBlock(uint64_t Sample) const;
+
+    std::streamoff Offset;
+    unsigned int StreamCount;
+    uint64_t SampleCount;
+    std::vector<elIndexBlock> Blocks;
+};
+
+/**
+ * An index of the blocks in an input file. It is saved next to the input so that later
+ * runs can go straight to the block they need instead of reading everything before it.
+ * The index remembers the size and time of the input and the settings it was made with,
+ * and only matches an input that still has them.
+ */
+class elDecodeIndex
+{
+public:
+    elDecodeIndex();
+    ~elDecodeIndex();
+
+    /// Clear the index and set what it will be for.
+    void Reset(uint64_t InputSize, int64_t InputTime, std::streamoff InputOffset, unsigned int Settings);
+
+    /// Does this index belong to an input with these properties?
+    bool Matches(uint64_t InputSize, int64_t InputTime, std::streamoff InputOffset, unsigned int Settings) const;
+
+    /// Get the name of the index file for an input file.
+    static std::string GetIndexFilename(const std::string& InputFilename);
+
+    /// Read an index file, returning false if it doesn't exist or isn't valid.
+    bool Load(const std::string& Filename);
+
+    /// Write the index file, returning false if it couldn't be written.
+    bool Save(const std::string& Filename) const;
+
+    /// Add a part that has been decoded completely.
+    void AddPart(const elIndexPart& Part);
+
+    /// Get the number of parts.
+    unsigned int GetPartCount() const;
+
+    /// Get a part.
+    const elIndexPart& GetPart(unsigned int Index) const;
+
+protected:
+    uint64_t m_InputSize;
+    int64_t m_InputTime;
+    int64_t m_InputOffset;
+    unsigned int m_Settings;
+
+    std::vector<elIndexPart> m_Parts;
+};
@@ -0,0 +1,635 @@
+/*
+ *  EA Layer 3 Extractor/Decoder
+ *  Copyright (C) 2011, Ben Moench.
+ *  See License.txt
+ */
+
+#include "Internal.h"
+#include "DecodePipeline.h"
+
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+using boost::format;
+using boost::posix_time::ptime;
+using std::runtime_error;
+
+#define PIPELINE_BLOCK_QUEUE_SIZE 16
+#define PIPELINE_PARSED_QUEUE_SIZE 16
+#define PIPELINE_WRITER_QUEUE_SIZE 256
+
+/// How many blocks per parser thread can be waiting to be put together.
+#define PIPELINE_FRAGMENTS_PER_THREAD 4
+
+const uint64_t elDecodePipeline::NO_SAMPLE = ~(uint64_t)0;
+
+
+static ptime _Now()
+{
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+
+static double _SecondsSince(const ptime& start)
+{
+    return (_Now() - start).total_microseconds() / 1000000.0;
+}
+
+
+/**
+ * Does a block holding the sample frames start up to end have to be decoded
+ * for the range first up to rangeEnd?
+ */
+static bool _IsInRange(uint64_t start, uint64_t end, uint64_t first, uint64_t rangeEnd)
+{
+    return start < rangeEnd && (end > first || start >= first);
+}
+
+
+static void _PrintStage(std::ostream& output, const char* name, const char* items,
+    const elDecodePipeline::StageStats& stats)
+{
+    const double megabytes = stats.bytes / (1024.0 * 1024.0);
+    output << format("  %-10s %8lu %-7s %9.2f MB  busy %8.3f s  %9.2f MB/s") %
+        name % stats.items % items % megabytes % stats.seconds %
+        (stats.seconds > 0.0 ? megabytes / stats.seconds : 0.0) << std::endl;
+    return;
+}
+
+
+static void _PrintQueue(std::ostream& output, const char* name, const elQueueStats& stats)
+{
+    output << format("  %-21s depth %6.1f avg %4u max  full %6lu times  empty %6lu times") %
+        name % stats.GetAverageDepth() % stats.MaxDepth % stats.FullWaits % stats.EmptyWaits << std::endl;
+    return;
+}
+
+
+/**
+ * Puts the frames from the generator on the writer's queue.
+ */
+class elQueuedFrameSink : public elMpegFrameSink
+{
+public:
+    elQueuedFrameSink(elBoundedQueue<elDecodePipeline::WriterItem>& queue) :
+        queue(queue)
+    {
+        return;
+    }
+
+    virtual void WriteFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size)
+    {
+        Push(StreamIndex, false, Data, Size);
+    }
+
+    virtual void PatchVbrFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size)
+    {
+        Push(StreamIndex, true, Data, Size);
+    }
+
+private:
+    void Push(unsigned int stream, bool patch, const uint8_t* data, unsigned int size)
+    {
+        elDecodePipeline::WriterItem item;
+        item.stream = stream;
+        item.patch = patch;
+        item.data.reset(new uint8_t[size]);
+        item.size = size;
+        memcpy(item.data.get(), data, size);
+
+        // If the writer has stopped, Run() reports why
+        queue.Push(item);
+    }
+
+    elBoundedQueue<elDecodePipeline::WriterItem>& queue;
+};
+
+
+elDecodePipeline::elDecodePipeline(elBlockLoader& loader, elMpegGenerator& gen) :
+    loader(loader),
+    gen(gen),
+    output(NULL),
+    indexPart(NULL),
+    rangeFirst(0),
+    rangeEnd(NO_SAMPLE),
+    skippedSamples(0),
+    loaderSample(0),
+    firstSample(NO_SAMPLE),
+    primedSamples(0),
+    keepFirstBlock(true),
+    primeParser(false),
+    parserThreadCount(1),
+    blocks(PIPELINE_BLOCK_QUEUE_SIZE),
+    parsed(PIPELINE_PARSED_QUEUE_SIZE),
+    writes(PIPELINE_WRITER_QUEUE_SIZE),
+    fragmentsStopped(false)
+{
+    return;
+}
+
+
+elDecodePipeline::~elDecodePipeline()
+{
+    Stop();
+    return;
+}
+
+
+elMpegFrameSink* elDecodePipeline::CreateWriter(elMpegFrameSink* output)
+{
+    this->output = output;
+    this->writer = make_shared<elQueuedFrameSink>(boost::ref(writes));
+    return this->writer.get();
+}
+
+
+void elDecodePipeline::SetIndexPart(elIndexPart* part)
+{
+    this->indexPart = part;
+    return;
+}
+
+
+void elDecodePipeline::SetSampleRange(uint64_t first, uint64_t end, const elIndexPart* index)
+{
+    this->rangeFirst = first;
+    this->rangeEnd = end;
+
+    if (!index || index->Blocks.empty())
+    {
+        return;
+    }
+
+    // The block holding first can start in the middle of a frame, so go to the
+    // one before it. The loader is already past the first block, so only seek
+    // past the second.
+    const unsigned int block = index->FindBlock(first);
+    if (block > 2 && loader.SeekToBlock(index->Blocks[block - 1].Offset, block - 1))
+    {
+        VERBOSE("Skipping to block " << block - 1 << " using the index");
+        this->skippedSamples = index->Blocks[block - 1].FirstSample - index->Blocks[1].FirstSample;
+    }
+    return;
+}
+
+
+void elDecodePipeline::SetParserThreads(unsigned int threads)
+{
+    this->parserThreadCount = threads;
+    return;
+}
+
+
+uint64_t elDecodePipeline::GetFirstSample() const
+{
+    if (this->firstSample == NO_SAMPLE)
+    {
+        return NO_SAMPLE;
+    }
+    return this->firstSample - this->primedSamples;
+}
+
+
+void elDecodePipeline::Run(const elBlock& firstBlock)
+{
+    // The loader's blocks come after the first block and anything skipped
+    loaderSample = firstBlock.SampleCount + skippedSamples;
+    keepFirstBlock = _IsInRange(0, firstBlock.SampleCount, rangeFirst, rangeEnd);
+    if (keepFirstBlock)
+    {
+        firstSample = 0;
+    }
+
+    // The block before the range can start a frame that the range needs
+    primeParser = !keepFirstBlock;
+
+    if (writer)
+    {
+        writerThread.create_thread(boost::bind(&elDecodePipeline::Write, this));
+    }
+    threads.create_thread(boost::bind(&elDecodePipeline::Load, this, boost::cref(firstBlock)));
+    threads.create_thread(boost::bind(&elDecodePipeline::Parse, this, boost::cref(firstBlock)));
+
+    try
+    {
+        shared_ptr<ParsedBlock> block;
+        while (parsed.Pop(block))
+        {
+            const ptime start = _Now();
+            if (indexPart)
+            {
+                AddToIndex(*block);
+            }
+            gen.AddParsedFrames(block->streams, block->sampleCount);
+            generatorStats.items++;
+            generatorStats.bytes += block->size;
+            block.reset();
+            generatorStats.seconds += _SecondsSince(start);
+        }
+
+        threads.join_all();
+        if (!loaderError.empty())
+        {
+            throw (runtime_error(loaderError));
+        }
+        if (!parserError.empty())
+        {
+            throw (runtime_error(parserError));
+        }
+
+        const ptime start = _Now();
+        gen.DoneParsingBlocks();
+        generatorStats.seconds += _SecondsSince(start);
+    }
+    catch (...)
+    {
+        Stop();
+        throw;
+    }
+
+    writes.Close();
+    writerThread.join_all();
+    if (!writerError.empty())
+    {
+        throw (runtime_error(writerError));
+    }
+    return;
+}
+
+
+void elDecodePipeline::PrintStats(std::ostream& output) const
+{
+    output << "Pipeline:" << std::endl;
+    _PrintStage(output, "Loader", "blocks", loaderStats);
+    _PrintStage(output, "Parser", "blocks", parserStats);
+    _PrintStage(output, "Generator", "blocks", generatorStats);
+    if (writer)
+    {
+        _PrintStage(output, "Writer", "frames", writerStats);
+    }
+    _PrintQueue(output, "Loader -> Parser", blocks.GetStats());
+    _PrintQueue(output, "Parser -> Generator", parsed.GetStats());
+    if (writer)
+    {
+        _PrintQueue(output, "Generator -> Writer", writes.GetStats());
+    }
+    return;
+}
+
+
+void elDecodePipeline::AddToIndex(const ParsedBlock& block)
+{
+    const unsigned int count = gen.GetStreamCount();
+    std::vector<unsigned int> firstFrame(count);
+    std::vector<unsigned int> firstGranule(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        firstFrame[i] = gen.GetParsedFrameCount(i);
+        firstGranule[i] = gen.GetParsedGranuleCount(i);
+    }
+
+    indexPart->StreamCount = count;
+    indexPart->AddBlock(block.offset, block.sampleCount, firstFrame, firstGranule);
+    return;
+}
+
+
+void elDecodePipeline::Load(const elBlock& firstBlock)
+{
+    try
+    {
+        // The last block that was skipped. After a seek the first block isn't next to the others.
+        elBlock skipped;
+        if (skippedSamples == 0)
+        {
+            skipped = firstBlock;
+        }
+
+        uint64_t sample = loaderSample;
+        while (sample < rangeEnd)
+        {
+            const ptime start = _Now();
+            elBlock block;
+            if (!loader.ReadNextBlock(block))
+            {
+                break;
+            }
+            loaderStats.items++;
+            loaderStats.bytes += block.Size;
+            loaderStats.seconds += _SecondsSince(start);
+
+            // Blocks before the range are never parsed
+            const uint64_t blockStart = sample;
+            sample += block.SampleCount;
+            if (!_IsInRange(blockStart, sample, rangeFirst, rangeEnd))
+            {
+                skipped = block;
+                continue;
+            }
+            if (firstSample == NO_SAMPLE)
+            {
+                firstSample = blockStart;
+
+                // Except for the one just before, in case the range starts in the middle of a frame
+                if (primeParser && !blocks.Push(skipped))
+                {
+                    break;
+                }
+            }
+
+            if (!blocks.Push(block))
+            {
+                break;
+            }
+        }
+    }
+    catch (std::exception& E)
+    {
+        loaderError = E.what();
+    }
+    catch (...)
+    {
+        loaderError = "Crash or something else while reading the input.";
+    }
+
+    blocks.Close();
+    return;
+}
+
+
+void elDecodePipeline::Parse(const elBlock& firstBlock)
+{
+    if (parserThreadCount > 1)
+    {
+        ParseInParallel(firstBlock);
+        return;
+    }
+
+    // The frames that weren't complete at the end of the last block
+    elStreamVector pending;
+
+    try
+    {
+        PrimeParser(pending);
+        unsigned long extraSamples = primedSamples;
+
+        elBlock block = firstBlock;
+        bool more = keepFirstBlock || blocks.Pop(block);
+        while (more)
+        {
+            const ptime start = _Now();
+            elStreamVector streams;
+            gen.ParseBlockFrames(block, pending, streams);
+            if (!PushParsed(streams, block, _SecondsSince(start), extraSamples))
+            {
+                break;
+            }
+            extraSamples = 0;
+            more = blocks.Pop(block);
+        }
+    }
+    catch (std::exception& E)
+    {
+        parserError = E.what();
+    }
+    catch (...)
+    {
+        parserError = "Crash or something else while parsing the input.";
+    }
+
+    // Stop the loader too if we gave up early
+    blocks.Close();
+    parsed.Close();
+    return;
+}
+
+
+/**
+ * Parse the block that the loader put in front of the range, if there is one.
+ * Only the frames it leaves pending are kept, for the first block of the range
+ * to finish, and their samples are counted in primedSamples.
+ */
+void elDecodePipeline::PrimeParser(elStreamVector& pending)
+{
+    elBlock block;
+    if (!primeParser || !blocks.Pop(block) || !block.Data)
+    {
+        return;
+    }
+
+    const ptime start = _Now();
+    elStreamVector streams;
+    gen.ParseBlockFrames(block, pending, streams);
+    for (unsigned int i = 0; !pending.empty() && i < pending[0].size(); i++)
+    {
+        // A granule is 576 sample frames
+        primedSamples += pending[0][i].Gr[0].Used ? 576 : 0;
+    }
+    parserStats.items++;
+    parserStats.bytes += block.Size;
+    parserStats.seconds += _SecondsSince(start);
+    return;
+}
+
+
+void elDecodePipeline::ParseInParallel(const elBlock& firstBlock)
+{
+    // The frames that weren't complete at the end of the last block
+    elStreamVector pending;
+
+    // The blocks handed to the parser threads, in the order they came in
+    std::deque< shared_ptr<FragmentJob> > inFlight;
+    const unsigned int window = parserThreadCount * PIPELINE_FRAGMENTS_PER_THREAD;
+
+    boost::thread_group parserThreads;
+    for (unsigned int i = 0; i < parserThreadCount; i++)
+    {
+        parserThreads.create_thread(boost::bind(&elDecodePipeline::ParseFragments, this));
+    }
+
+    try
+    {
+        // Initialize() already parsed the first block
+        bool more = true;
+        if (keepFirstBlock)
+        {
+            const ptime start = _Now();
+            elStreamVector streams;
+            gen.ParseBlockFrames(firstBlock, pending, streams);
+            more = PushParsed(streams, firstBlock, _SecondsSince(start));
+        }
+        PrimeParser(pending);
+        unsigned long extraSamples = primedSamples;
+
+        while (more || !inFlight.empty())
+        {
+            // Keep the parser threads busy
+            while (more && inFlight.size() < window)
+            {
+                shared_ptr<FragmentJob> job = make_shared<FragmentJob>();
+                more = blocks.Pop(job->block);
+                if (more)
+                {
+                    inFlight.push_back(job);
+                    boost::mutex::scoped_lock lock(fragmentMutex);
+                    fragmentJobs.push_back(job);
+                    fragmentChanged.notify_one();
+                }
+            }
+            if (inFlight.empty())
+            {
+                break;
+            }
+
+            // Put the oldest block together with the ones before it
+            shared_ptr<FragmentJob> job = inFlight.front();
+            inFlight.pop_front();
+            {
+                boost::mutex::scoped_lock lock(fragmentMutex);
+                while (!job->done)
+                {
+                    fragmentChanged.wait(lock);
+                }
+            }
+            if (!job->error.empty())
+            {
+                throw (runtime_error(job->error));
+            }
+
+            const ptime start = _Now();
+            elStreamVector streams;
+            gen.MergeBlockFragment(job->fragment, pending, streams);
+            if (!PushParsed(streams, job->block, job->seconds + _SecondsSince(start), extraSamples))
+            {
+                break;
+            }
+            extraSamples = 0;
+        }
+    }
+    catch (std::exception& E)
+    {
+        parserError = E.what();
+    }
+    catch (...)
+    {
+        parserError = "Crash or something else while parsing the input.";
+    }
+
+    {
+        boost::mutex::scoped_lock lock(fragmentMutex);
+        fragmentsStopped = true;
+        fragmentJobs.clear();
+        fragmentChanged.notify_all();
+    }
+    parserThreads.join_all();
+
+    // Stop the loader too if we gave up early
+    blocks.Close();
+    parsed.Close();
+    return;
+}
+
+
+void elDecodePipeline::ParseFragments()
+{
+    shared_ptr<elParser> parser = gen.CloneParser();
+    while (true)
+    {
+        shared_ptr<FragmentJob> job;
+        {
+            boost::mutex::scoped_lock lock(fragmentMutex);
+            while (!fragmentsStopped && fragmentJobs.empty())
+            {
+                fragmentChanged.wait(lock);
+            }
+            if (fragmentsStopped)
+            {
+                return;
+            }
+            job = fragmentJobs.front();
+            fragmentJobs.pop_front();
+        }
+
+        const ptime start = _Now();
+        try
+        {
+            gen.ParseBlockFragment(*parser, job->block, job->fragment);
+        }
+        catch (std::exception& E)
+        {
+            job->error = E.what();
+        }
+        catch (...)
+        {
+            job->error = "Crash or something else while parsing the input.";
+        }
+        job->seconds = _SecondsSince(start);
+
+        boost::mutex::scoped_lock lock(fragmentMutex);
+        job->done = true;
+        fragmentChanged.notify_all();
+    }
+}
+
+
+bool elDecodePipeline::PushParsed(elStreamVector& streams, const elBlock& block, double seconds,
+    unsigned long extraSamples)
+{
+    shared_ptr<ParsedBlock> result = make_shared<ParsedBlock>();
+    result->streams.swap(streams);
+    result->offset = block.Offset;
+    result->sampleCount = block.SampleCount + extraSamples;
+    result->size = block.Size;
+    parserStats.items++;
+    parserStats.bytes += block.Size;
+    parserStats.seconds += seconds;
+    return parsed.Push(result);
+}
+
+
+void elDecodePipeline::Write()
+{
+    try
+    {
+        WriterItem item;
+        while (writes.Pop(item))
+        {
+            const ptime start = _Now();
+            if (item.patch)
+            {
+                output->PatchVbrFrame(item.stream, item.data.get(), item.size);
+            }
+            else
+            {
+                output->WriteFrame(item.stream, item.data.get(), item.size);
+                writerStats.items++;
+                writerStats.bytes += item.size;
+            }
+            writerStats.seconds += _SecondsSince(start);
+        }
+    }
+    catch (std::exception& E)
+    {
+        writerError = E.what();
+    }
+    catch (...)
+    {
+        writerError = "Crash or something else while writing the output.";
+    }
+
+    writes.Close();
+    return;
+}
+
+
+void elDecodePipeline::Stop()
+{
+    blocks.Close();
+    parsed.Close();
+    writes.Close();
+    threads.join_all();
+    writerThread.join_all();
+    return;
+}
@@ -0,0 +1,181 @@
+/*
+ *  EA Layer 3 Extractor/Decoder
+ *  Copyright (C) 2011, Ben Moench.
+ *  See License.txt
+ */
+
+#pragma once
+
+#include "Internal.h"
+#include "Parser.h"
+#include "MpegGenerator.h"
+#include "BlockLoader.h"
+#include "BoundedQueue.h"
+#include "DecodeIndex.h"
+
+#include <deque>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * Runs the block loader, the parser, the MPEG frame generator and the output
+ * writer as stages on their own threads, with a queue between each of them,
+ * so that reading the input overlaps with the bit-level work.
+ */
+class elDecodePipeline
+{
+public:
+
+    elDecodePipeline(elBlockLoader& loader, elMpegGenerator& gen);
+    ~elDecodePipeline();
+
+    /**
+     * Get a sink that passes frames on to output from the writer thread. Give
+     * it to elMpegGenerator::SetStreaming() before calling Run(). Without it
+     * the frames stay in the generator and there is no writer stage.
+     */
+    elMpegFrameSink* CreateWriter(elMpegFrameSink* output);
+
+    /**
+     * Add every block that goes through the generator to the part, along with
+     * where its frames start.
+     */
+    void SetIndexPart(elIndexPart* part);
+
+    /**
+     * Only put the blocks holding sample frames first up to end through the
+     * generator. The blocks before them are read but not parsed, apart from the
+     * last one, which can hold the start of a frame that the range needs.
+     * Reading stops at end. With an index of the part the loader goes straight
+     * to the block before the one holding first.
+     */
+    void SetSampleRange(uint64_t first, uint64_t end, const elIndexPart* index = NULL);
+
+    /**
+     * Get the sample frame that the first frame put through the generator
+     * starts at, or NO_SAMPLE if there wasn't one.
+     */
+    uint64_t GetFirstSample() const;
+
+    static const uint64_t NO_SAMPLE;
+
+    /**
+     * Parse up to this many blocks at once, each on its own thread with its own
+     * copy of the parser. The parser stage then only puts the pieces together
+     * in order. 0 or 1 parses one block at a time.
+     */
+    void SetParserThreads(unsigned int threads);
+
+    /**
+     * Put the first block (which was already used to initialize the
+     * generator) and the rest of the loader's blocks through the generator,
+     * then call DoneParsingBlocks(). The generator runs on the calling thread.
+     */
+    void Run(const elBlock& firstBlock);
+
+    /**
+     * Write how busy each stage was and how full the queues between them got.
+     */
+    void PrintStats(std::ostream& output) const;
+
+
+    /**
+     * What a stage did. The time doesn't include waiting on the queues.
+     */
+    struct StageStats
+    {
+        StageStats() : items(0), bytes(0), seconds(0.0) {};
+
+        unsigned long items;
+        unsigned long bytes;
+        double seconds;
+    };
+
+    /**
+     * A block that has been through the parser.
+     */
+    struct ParsedBlock
+    {
+        elStreamVector streams;
+        std::streamoff offset;
+        unsigned long sampleCount;
+        unsigned int size;
+    };
+
+    /**
+     * A block being parsed on its own by one of the parser threads.
+     */
+    struct FragmentJob
+    {
+        FragmentJob() : seconds(0.0), done(false) {};
+
+        elBlock block;
+        elStreamVector fragment;
+        std::string error;
+        double seconds;
+        bool done;
+    };
+
+    /**
+     * A frame, or an update to the VBR info frame, on its way to the writer.
+     */
+    struct WriterItem
+    {
+        unsigned int stream;
+        bool patch;
+        shared_array<uint8_t> data;
+        unsigned int size;
+    };
+
+
+private:
+    elBlockLoader& loader;
+    elMpegGenerator& gen;
+    elMpegFrameSink* output;
+    shared_ptr<elMpegFrameSink> writer;
+    elIndexPart* indexPart;
+
+    uint64_t rangeFirst;
+    uint64_t rangeEnd;
+    uint64_t skippedSamples;
+    uint64_t loaderSample;
+    uint64_t firstSample;
+    uint64_t primedSamples;
+    bool keepFirstBlock;
+    bool primeParser;
+    unsigned int parserThreadCount;
+
+    elBoundedQueue<elBlock> blocks;
+    elBoundedQueue< shared_ptr<ParsedBlock> > parsed;
+    elBoundedQueue<WriterItem> writes;
+
+    StageStats loaderStats;
+    StageStats parserStats;
+    StageStats generatorStats;
+    StageStats writerStats;
+
+    std::string loaderError;
+    std::string parserError;
+    std::string writerError;
+
+    boost::thread_group threads;
+    boost::thread_group writerThread;
+
+    std::deque< shared_ptr<FragmentJob> > fragmentJobs;
+    bool fragmentsStopped;
+    boost::mutex fragmentMutex;
+    boost::condition_variable fragmentChanged;
+
+private:
+    void AddToIndex(const ParsedBlock& block);
+    void Load(const elBlock& firstBlock);
+    void PrimeParser(elStreamVector& pending);
+    void Parse(const elBlock& firstBlock);
+    void ParseInParallel(const elBlock& firstBlock);
+    void ParseFragments();
+    bool PushParsed(elStreamVector& streams, const elBlock& block, double seconds,
+        unsigned long extraSamples = 0);
+    void Write();
+    void Stop();
+};
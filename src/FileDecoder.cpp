@@ -14,14 +14,48 @@
 #include "MpegOutputStream.h"
 #include "PcmOutputStream.h"
 #include "WaveWriter.h"
+#include "MappedInputStream.h"
+#include "RewindableInputStream.h"
+#include "BoundedQueue.h"
+#include "DecodePipeline.h"
+#include "DecodeIndex.h"
+#include "Interleave.h"
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
 #include <stdexcept>
 #include <boost/format.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 using boost::format;
 using std::runtime_error;
 
+/// How much to decode before the start of a range, so that the decoder has
+/// the previous granules to overlap with by the time it gets there.
+#define RANGE_WARMUP_SAMPLES 2304
+
+/// How many frames a segment of a long stream has when it's decoded on more
+/// than one thread, about 25 seconds at 44100 Hz.
+#define PCM_SEGMENT_FRAMES 1024
+
+/// How many frames before a segment are decoded and thrown away, so that the
+/// bit reservoir and the overlap are there when it starts.
+#define PCM_SEGMENT_WARMUP_FRAMES 8
+
+const char* const elFileDecoder::STDOUT_FILENAME = "-";
+const char* const elFileDecoder::STDIN_FILENAME = "-";
+
 
 static void _SeparateFilename(const std::string& Filename, std::string& PathAndName, std::string& Ext)
 {
@@ -42,13 +76,395 @@ static void _SeparateFilename(const std::string& Filename, std::string& PathAndN
 }
 
 
+/**
+ * Converts a position to sample frames.
+ */
+static uint64_t _ToSamples(unsigned long value, elFileDecoder::Unit unit, unsigned int sampleRate)
+{
+    if (unit == elFileDecoder::U_MILLISECONDS)
+    {
+        return (uint64_t) value * sampleRate / 1000;
+    }
+    return value;
+}
+
+
+/**
+ * Runs a task, keeping the message of anything it throws so another thread can
+ * report it.
+ */
+static void _RunTask(const boost::function<void ()>& task, std::string& error)
+{
+    try
+    {
+        task();
+    }
+    catch (std::exception& E)
+    {
+        error = E.what();
+    }
+    catch (...)
+    {
+        error = "Crash or something else while writing a stream.";
+    }
+    return;
+}
+
+
+/**
+ * Throws the first error kept by _RunTask, if any.
+ */
+static void _ThrowFirstError(const std::vector<std::string>& errors)
+{
+    for (unsigned int i = 0; i < errors.size(); i++)
+    {
+        if (!errors[i].empty())
+        {
+            throw (runtime_error(errors[i]));
+        }
+    }
+    return;
+}
+
+
+/**
+ * A block of samples decoded from one stream for WriteMultiWave.
+ */
+struct elPcmChunk
+{
+    shared_array<short> samples;
+    unsigned int count;
+};
+
+typedef elBoundedQueue<elPcmChunk> elPcmChunkQueue;
+
+
+/**
+ * Decodes a stream into the queue until the stream ends or the queue is closed.
+ */
+static void _DecodePcmStream(elPcmOutputStream& stream, elPcmChunkQueue& queue, unsigned int bufferSamples)
+{
+    while (!stream.Eos())
+    {
+        elPcmChunk chunk;
+        chunk.samples.reset(new short[bufferSamples]);
+        chunk.count = stream.Read(chunk.samples.get(), bufferSamples);
+        if (!queue.Push(chunk))
+        {
+            break;
+        }
+    }
+    return;
+}
+
+
+/**
+ * Runs one decoding thread per stream for WriteMultiWave, and makes sure they
+ * have all stopped before it goes away. Every stream reads bufferFrames sample
+ * frames at a time, and Read() fills the whole buffer until the stream ends,
+ * so that their chunks line up.
+ */
+class elPcmStreamDecoders
+{
+public:
+    elPcmStreamDecoders(const std::vector< shared_ptr<elPcmOutputStream> >& streams, unsigned int bufferFrames) :
+        errors(streams.size())
+    {
+        for (unsigned int i = 0; i < streams.size(); i++)
+        {
+            queues.push_back(make_shared<elPcmChunkQueue>(8));
+        }
+        for (unsigned int i = 0; i < streams.size(); i++)
+        {
+            threads.create_thread(boost::bind(&elPcmStreamDecoders::Decode, this,
+                streams[i], queues[i], bufferFrames * streams[i]->GetChannels(), i));
+        }
+    }
+    
+    ~elPcmStreamDecoders()
+    {
+        Stop();
+    }
+    
+    /// Get the next chunk of a stream. Returns false when the stream has ended.
+    bool Pop(unsigned int index, elPcmChunk& chunk)
+    {
+        return queues[index]->Pop(chunk);
+    }
+    
+    /// Stop all of the threads and throw the first error any of them had.
+    void Finish()
+    {
+        Stop();
+        _ThrowFirstError(errors);
+    }
+    
+private:
+    void Decode(shared_ptr<elPcmOutputStream> stream, shared_ptr<elPcmChunkQueue> queue,
+        unsigned int bufferSamples, unsigned int index)
+    {
+        _RunTask(boost::bind(&_DecodePcmStream, boost::ref(*stream), boost::ref(*queue), bufferSamples),
+            errors[index]);
+        queue->Close();
+    }
+    
+    void Stop()
+    {
+        for (unsigned int i = 0; i < queues.size(); i++)
+        {
+            queues[i]->Close();
+        }
+        threads.join_all();
+    }
+    
+    std::vector< shared_ptr<elPcmChunkQueue> > queues;
+    std::vector<std::string> errors;
+    boost::thread_group threads;
+};
+
+
+/**
+ * Decodes the frames from first up to end of a stream into samples.
+ */
+static void _DecodePcmSegment(const elMpegGenerator& gen, unsigned int index, unsigned int first,
+    unsigned int end, std::vector<short>& samples)
+{
+    shared_ptr<elPcmOutputStream> stream = gen.CreatePcmStream(index);
+    stream->SetFrameRange(first, end, PCM_SEGMENT_WARMUP_FRAMES);
+    
+    const unsigned int bufferSamples = elPcmOutputStream::RecommendBufferSize();
+    samples.reserve((end - first) * 1152 * stream->GetChannels() + bufferSamples);
+    while (!stream->Eos())
+    {
+        const unsigned int used = samples.size();
+        samples.resize(used + bufferSamples);
+        samples.resize(used + stream->Read(&samples[used], bufferSamples));
+    }
+    return;
+}
+
+
+/**
+ * Splits one long stream into segments of PCM_SEGMENT_FRAMES and decodes them
+ * on a few threads for WriteWave, handing them back in order. Only a couple of
+ * segments past the one being written are decoded ahead, so the memory use
+ * stays the same however long the stream is.
+ */
+class elPcmSegmentDecoders
+{
+public:
+    elPcmSegmentDecoders(const elMpegGenerator& gen, unsigned int index, unsigned int threadCount) :
+        gen(gen),
+        index(index),
+        frameCount(gen.GetFrameCount(index)),
+        window(threadCount * 2),
+        nextDecode(0),
+        nextPop(0),
+        stopped(false)
+    {
+        segments.resize((frameCount + PCM_SEGMENT_FRAMES - 1) / PCM_SEGMENT_FRAMES);
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            threads.create_thread(boost::bind(&elPcmSegmentDecoders::Decode, this));
+        }
+    }
+    
+    ~elPcmSegmentDecoders()
+    {
+        Stop();
+    }
+    
+    /// Wait for the next segment. Returns false when there are no more or one failed.
+    bool Pop(std::vector<short>& samples)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (nextPop >= segments.size())
+        {
+            return false;
+        }
+        while (!segments[nextPop].done && error.empty())
+        {
+            changed.wait(lock);
+        }
+        if (!error.empty())
+        {
+            return false;
+        }
+        
+        samples.clear();
+        samples.swap(segments[nextPop].samples);
+        nextPop++;
+        changed.notify_all();
+        return true;
+    }
+    
+    /// Stop all of the threads and throw the error one of them had.
+    void Finish()
+    {
+        Stop();
+        if (!error.empty())
+        {
+            throw (runtime_error(error));
+        }
+    }
+    
+private:
+    struct Segment
+    {
+        Segment() : done(false) {}
+        std::vector<short> samples;
+        bool done;
+    };
+    
+    void Decode()
+    {
+        while (true)
+        {
+            unsigned int segment;
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                while (!stopped && error.empty() && nextDecode < segments.size() &&
+                    nextDecode >= nextPop + window)
+                {
+                    changed.wait(lock);
+                }
+                if (stopped || !error.empty() || nextDecode >= segments.size())
+                {
+                    return;
+                }
+                segment = nextDecode++;
+            }
+            
+            const unsigned int first = segment * PCM_SEGMENT_FRAMES;
+            const unsigned int end = std::min(first + PCM_SEGMENT_FRAMES, frameCount);
+            std::vector<short> samples;
+            std::string segmentError;
+            _RunTask(boost::bind(&_DecodePcmSegment, boost::cref(gen), index, first, end, boost::ref(samples)),
+                segmentError);
+            
+            boost::mutex::scoped_lock lock(mutex);
+            segments[segment].samples.swap(samples);
+            segments[segment].done = true;
+            if (!segmentError.empty() && error.empty())
+            {
+                error = segmentError;
+            }
+            changed.notify_all();
+        }
+    }
+    
+    void Stop()
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            stopped = true;
+            changed.notify_all();
+        }
+        threads.join_all();
+    }
+    
+    const elMpegGenerator& gen;
+    const unsigned int index;
+    const unsigned int frameCount;
+    const unsigned int window;
+    std::vector<Segment> segments;
+    unsigned int nextDecode;
+    unsigned int nextPop;
+    bool stopped;
+    std::string error;
+    boost::mutex mutex;
+    boost::condition_variable changed;
+    boost::thread_group threads;
+};
+
+
+/**
+ * Writes the frames of a streaming generator straight to the MP3 output files.
+ */
+class elMp3FileSink : public elMpegFrameSink
+{
+public:
+    /// Add the output for the next stream, or NULL to drop its frames. The VBR
+    /// info frame is only patched if the output can seek.
+    void AddOutput(std::ostream* output, bool seekable = true)
+    {
+        outputs.push_back(output);
+        starts.push_back(output && seekable ? std::streamoff(output->tellp()) : -1);
+    }
+    
+    virtual void WriteFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size)
+    {
+        if (outputs[StreamIndex])
+        {
+            outputs[StreamIndex]->write((const char*) Data, Size);
+        }
+    }
+    
+    virtual void PatchVbrFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size)
+    {
+        std::ostream* output = outputs[StreamIndex];
+        if (output && starts[StreamIndex] >= 0)
+        {
+            const std::streampos end = output->tellp();
+            output->seekp(starts[StreamIndex]);
+            output->write((const char*) Data, Size);
+            output->seekp(end);
+        }
+    }
+    
+private:
+    std::vector<std::ostream*> outputs;
+    std::vector<std::streamoff> starts;
+};
+
+
+/**
+ * Sends std::cout to std::cerr while it's around, so that the messages don't
+ * end up in output written to stdout.
+ */
+class elStdoutOutput
+{
+public:
+    elStdoutOutput() :
+        output(std::cout.rdbuf()),
+        previous(std::cout.rdbuf(std::cerr.rdbuf()))
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+    
+    ~elStdoutOutput()
+    {
+        output.flush();
+        std::cout.rdbuf(previous);
+    }
+    
+    /// Writes to the real stdout.
+    std::ostream output;
+    
+private:
+    std::streambuf* previous;
+};
+
+
 elFileDecoder::elFileDecoder() :
     inputFilename(""),
     inputOffset(0),
     inputStream(-1),
     inputParser(P_AUTO),
     outputFilename(""),
-    outputFormat(F_AUTO)
+    outputFormat(F_AUTO),
+    streaming(false),
+    indexing(false),
+    rangeStart(0),
+    rangeStartUnit(U_SAMPLES),
+    rangeLength(0),
+    rangeLengthUnit(U_SAMPLES),
+    decodeThreads(0),
+    pcmSkip(0),
+    pcmCount(0),
+    stdOutput(NULL)
 {
     return;
 }
@@ -74,6 +490,12 @@ const std::string& elFileDecoder::GetInput() const
 }
 
 
+std::streamoff elFileDecoder::GetInputOffset() const
+{
+    return this->inputOffset;
+}
+
+
 void elFileDecoder::SetStream(int stream)
 {
     this->inputStream = stream;
@@ -114,12 +536,79 @@ const std::string& elFileDecoder::GetOutputFilename() const
 }
 
 
+bool elFileDecoder::WritesToStdout() const
+{
+    return this->outputFilename == STDOUT_FILENAME;
+}
+
+
+bool elFileDecoder::ReadsFromStdin() const
+{
+    return this->inputFilename == STDIN_FILENAME;
+}
+
+
 elFileDecoder::Format elFileDecoder::GetOutputFormat() const
 {
     return this->outputFormat;
 }
 
 
+void elFileDecoder::SetStreaming(bool streaming)
+{
+    this->streaming = streaming;
+    return;
+}
+
+
+bool elFileDecoder::GetStreaming() const
+{
+    return this->streaming;
+}
+
+
+void elFileDecoder::SetIndexing(bool indexing)
+{
+    this->indexing = indexing;
+    return;
+}
+
+
+bool elFileDecoder::GetIndexing() const
+{
+    return this->indexing;
+}
+
+
+void elFileDecoder::SetRange(unsigned long start, Unit startUnit, unsigned long length, Unit lengthUnit)
+{
+    this->rangeStart = start;
+    this->rangeStartUnit = startUnit;
+    this->rangeLength = length;
+    this->rangeLengthUnit = lengthUnit;
+    return;
+}
+
+
+bool elFileDecoder::HasRange() const
+{
+    return this->rangeStart > 0 || this->rangeLength > 0;
+}
+
+
+void elFileDecoder::SetDecodeThreads(unsigned int threads)
+{
+    this->decodeThreads = threads;
+    return;
+}
+
+
+unsigned int elFileDecoder::GetDecodeThreads() const
+{
+    return this->decodeThreads;
+}
+
+
 void elFileDecoder::Process()
 {
     // First, make sure we've got some kind of output format
@@ -128,26 +617,56 @@ void elFileDecoder::Process()
         // Autodectect based on extension
     }
     
-    // Open the input file
-    std::ifstream input;
-    input.open(inputFilename.c_str(), std::ios_base::in | std::ios_base::binary);
-    if (!input.is_open())
+    // Open the input file, mapping it into memory if we can. Pipes can't seek, so
+    // they go through a buffer that lets the loaders look at the start of them.
+    elMappedInputStream mappedInput;
+    std::ifstream fileInput;
+    elRewindableInputStream pipeInput;
+    if (ReadsFromStdin())
     {
-        throw (runtime_error("Could not open input file '" + inputFilename + "'."));
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        pipeInput.Open(std::cin.rdbuf());
     }
+    else if (!mappedInput.Open(inputFilename))
+    {
+        fileInput.open(inputFilename.c_str(), std::ios_base::in | std::ios_base::binary);
+        if (!fileInput.is_open())
+        {
+            throw (runtime_error("Could not open input file '" + inputFilename + "'."));
+        }
+        if (!elRewindableInputStream::IsSeekable(fileInput.rdbuf()))
+        {
+            pipeInput.Open(fileInput.rdbuf());
+        }
+    }
+    std::istream& input = pipeInput.IsOpen() ? (std::istream&) pipeInput :
+        mappedInput.IsOpen() ? (std::istream&) mappedInput : fileInput;
     
-    // Get file size
+    // Get file size, which is -1 for a pipe
     std::streampos fileSize;
     input.seekg(0, std::ios_base::end);
     fileSize = input.tellg();
+    input.clear();
     input.seekg(inputOffset);
     
+    OpenIndex();
+    
+    shared_ptr<elStdoutOutput> stdoutOutput;
+    stdOutput = NULL;
+    if (WritesToStdout())
+    {
+        stdoutOutput = make_shared<elStdoutOutput>();
+        stdOutput = &stdoutOutput->output;
+    }
+    
     // Process the first part
     currentPart = 0;
     ProcessPart(input);
     
     // Are there more parts?
-    while (!input.eof() && (4 + input.tellg()) < fileSize)
+    while (!stdOutput && !HasRange() && HasMoreInput(input, fileSize))
     {
         currentPart++;
         
@@ -168,13 +687,102 @@ void elFileDecoder::Process()
         }
     }
     
+    stdOutput = NULL;
+    SaveIndex();
+    
     VERBOSE("Done.");
     return;
 }
 
 
-void elFileDecoder::ProcessPart(std::ifstream& input)
+bool elFileDecoder::HasMoreInput(std::istream& input, std::streamoff fileSize) const
+{
+    if (input.eof())
+    {
+        return false;
+    }
+    
+    // There is no size to go by on a pipe
+    if (fileSize < 0)
+    {
+        return input.peek() != std::char_traits<char>::eof();
+    }
+    return (4 + input.tellg()) < fileSize;
+}
+
+
+void elFileDecoder::OpenIndex()
+{
+    index.reset();
+    newIndex.reset();
+    if (!indexing)
+    {
+        return;
+    }
+    
+    // The index has to be thrown away when the input changes
+    boost::system::error_code error;
+    const uint64_t size = boost::filesystem::file_size(inputFilename, error);
+    if (error)
+    {
+        return;
+    }
+    const int64_t time = boost::filesystem::last_write_time(inputFilename, error);
+    if (error)
+    {
+        return;
+    }
+    
+    const std::string indexFilename = elDecodeIndex::GetIndexFilename(inputFilename);
+    shared_ptr<elDecodeIndex> existing = make_shared<elDecodeIndex>();
+    if (existing->Load(indexFilename) && existing->Matches(size, time, inputOffset, inputParser))
+    {
+        VERBOSE("Using the index in '" << indexFilename << "'");
+        index = existing;
+        return;
+    }
+    
+    // Only a whole decode can make an index
+    if (HasRange())
+    {
+        return;
+    }
+    
+    newIndex = make_shared<elDecodeIndex>();
+    newIndex->Reset(size, time, inputOffset, inputParser);
+    return;
+}
+
+
+void elFileDecoder::SaveIndex()
 {
+    if (!newIndex)
+    {
+        return;
+    }
+    
+    // Not being able to write the index doesn't stop the decode
+    const std::string indexFilename = elDecodeIndex::GetIndexFilename(inputFilename);
+    if (newIndex->Save(indexFilename))
+    {
+        VERBOSE("Wrote the index to '" << indexFilename << "'");
+    }
+    else
+    {
+        VERBOSE("Could not write the index to '" << indexFilename << "'");
+    }
+    
+    index = newIndex;
+    newIndex.reset();
+    return;
+}
+
+
+void elFileDecoder::ProcessPart(std::istream& input)
+{
+    elIndexPart indexPart;
+    indexPart.Offset = input.tellg();
+    
     // Determine the input's file type here
     elBlockLoaderSelector loader;
     if (!loader.Initialize(&input))
@@ -221,31 +829,107 @@ void elFileDecoder::ProcessPart(std::ifstream& input)
             (inputStream + 1) % gen.GetStreamCount()).str()));
     }
     
+    if (outputFormat == F_AUTO)
+    {
+        AutoSetOutputFormat();
+    }
+    
+    // Read, parse and generate on separate threads
+    elDecodePipeline pipeline(loader, gen);
+    pipeline.SetParserThreads(decodeThreads ? decodeThreads : boost::thread::hardware_concurrency());
+    
+    // In streaming mode the frames are written out while the blocks are parsed
+    elMp3FileSink sink;
+    std::vector< shared_ptr<std::ofstream> > sinkFiles;
+    const bool streamOutput = streaming && outputFormat == F_MP3;
+    if (streamOutput)
+    {
+        const unsigned int count = gen.GetStreamCount();
+        const unsigned int outputCount = inputStream == -1 ? count : 1;
+        if (stdOutput && outputCount > 1)
+        {
+            throw (runtime_error("Only one stream can be written to stdout."));
+        }
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (inputStream != -1 && inputStream != (int)i)
+            {
+                sink.AddOutput(NULL);
+                continue;
+            }
+            
+            // The VBR info frame can't be patched once it's down a pipe, so it
+            // goes out as the placeholder without the frame and byte counts
+            shared_ptr<std::ofstream> outFile = make_shared<std::ofstream>();
+            sink.AddOutput(&OpenOutput(*outFile, GenStreamFilename(i, outputCount)), !stdOutput);
+            sinkFiles.push_back(outFile);
+        }
+        gen.SetStreaming(pipeline.CreateWriter(&sink));
+    }
+    
+    if (newIndex)
+    {
+        pipeline.SetIndexPart(&indexPart);
+    }
+    
+    // Only parse the blocks around the range
+    uint64_t start = 0;
+    uint64_t length = 0;
+    if (HasRange())
+    {
+        const unsigned int sampleRate = gen.GetSampleRate();
+        start = _ToSamples(rangeStart, rangeStartUnit, sampleRate);
+        length = _ToSamples(rangeLength, rangeLengthUnit, sampleRate);
+        
+        // The frames before the start only need decoding for WAV output
+        uint64_t first = start;
+        if (outputFormat != F_MP3)
+        {
+            first = start > RANGE_WARMUP_SAMPLES ? start - RANGE_WARMUP_SAMPLES : 0;
+        }
+        
+        const elIndexPart* part = NULL;
+        if (index && currentPart < (int)index->GetPartCount() &&
+            index->GetPart(currentPart).Offset == indexPart.Offset)
+        {
+            part = &index->GetPart(currentPart);
+        }
+        pipeline.SetSampleRange(first, length ? start + length : elDecodePipeline::NO_SAMPLE, part);
+    }
+    
     // Load in the file
     VERBOSE("Parsing blocks...");
-    gen.ParseBlock(firstBlock);
+    pipeline.Run(firstBlock);
     
-    while (true)
+    if (newIndex)
     {
-        elBlock block;
-        if (!loader.ReadNextBlock(block))
+        newIndex->AddPart(indexPart);
+    }
+    
+    if (HasRange())
+    {
+        const uint64_t firstSample = pipeline.GetFirstSample();
+        if (firstSample == elDecodePipeline::NO_SAMPLE)
         {
-            break;
+            throw (runtime_error("The start of the range is past the end of the input."));
         }
-        
-        gen.ParseBlock(block);
+        pcmSkip = start > firstSample ? start - firstSample : 0;
+        pcmCount = length ? length : std::numeric_limits<unsigned long>::max();
+    }
+    
+    if (g_Verbose >= 1)
+    {
+        pipeline.PrintStats(std::cout);
     }
     
-    gen.DoneParsingBlocks();
+    if (streamOutput)
+    {
+        return;
+    }
     
     // Write it out in the preferred output format
     VERBOSE("Writing output file...");
     
-    if (outputFormat == F_AUTO)
-    {
-        AutoSetOutputFormat();
-    }
-
     if (inputStream == -1)
     {
         if (outputFormat == F_MULTI_WAVE)
@@ -309,7 +993,7 @@ std::string elFileDecoder::GenOutputFilename(const std::string& append) const
     
     if (outputFilename.empty())
     {
-        _SeparateFilename(inputFilename, pathAndName, ext);
+        _SeparateFilename(ReadsFromStdin() ? "stdin" : inputFilename, pathAndName, ext);
         
         switch (outputFormat)
         {
@@ -335,97 +1019,139 @@ std::string elFileDecoder::GenOutputFilename(const std::string& append) const
 }
 
 
-void elFileDecoder::WriteSingleStream(elMpegGenerator& gen)
+std::string elFileDecoder::GenStreamFilename(unsigned int index, unsigned int count) const
 {
-    // Get output file name
-    std::string filename;
     if (currentPart == 0)
     {
-        filename = GenOutputFilename("");
+        if (count == 1)
+        {
+            return GenOutputFilename("");
+        }
+        return GenOutputFilename((format("_%i") % (index + 1)).str());
+    }
+    
+    if (count == 1)
+    {
+        return GenOutputFilename((format("_part%i") % (currentPart + 1)).str());
     }
-    else
+    return GenOutputFilename((format("_%ipart%i") % (index + 1) % (currentPart + 1)).str());
+}
+
+
+shared_ptr<elPcmOutputStream> elFileDecoder::CreatePcmStream(elMpegGenerator& gen, unsigned int index) const
+{
+    shared_ptr<elPcmOutputStream> stream = gen.CreatePcmStream(index);
+    if (HasRange())
     {
-        filename = GenOutputFilename((format("_part%i") % (currentPart + 1)).str());
+        stream->SetRange(pcmSkip, pcmCount);
+    }
+    return stream;
+}
+
+
+std::ostream& elFileDecoder::OpenOutput(std::ofstream& file, const std::string& filename) const
+{
+    if (stdOutput)
+    {
+        return *stdOutput;
     }
     
-    // Open it and write it
-    std::ofstream outFile;
     VERBOSE("Output file: " << filename);
-    outFile.open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
-    if (!outFile.is_open())
+    file.open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!file.is_open())
     {
         throw (runtime_error("Could not open output file '" + filename + "'."));
     }
-    
-    WriteMp3OrWave(outFile, gen, inputStream);
+    return file;
 }
 
 
-void elFileDecoder::WriteAllStreams(elMpegGenerator& gen)
+void elFileDecoder::FinishWave(std::ostream& output, unsigned int sampleRate, unsigned int channels,
+    unsigned long expected, unsigned long written) const
 {
-    const int count = gen.GetStreamCount();
-    for (unsigned int i = 0; i < count; i++)
+    // The header written up front can't be fixed on stdout, so fill in the rest
+    if (stdOutput)
     {
-        // Get output file name
-        std::string filename;
-        if (currentPart == 0)
+        const std::vector<short> silence(channels * 1152, 0);
+        while (written < expected)
         {
-            if (count == 1)
-            {
-                filename = GenOutputFilename("");
-            }
-            else
-            {
-                filename = GenOutputFilename((format("_%i") % (i + 1)).str());
-            }
+            const unsigned long count = std::min<unsigned long>(expected - written, silence.size());
+            output.write((const char*) &silence[0], count * sizeof(short));
+            written += count;
         }
-        else
+        return;
+    }
+    
+    output.seekp(0);
+    WriteWaveHeader(output, sampleRate, 16, channels, written);
+}
+
+
+void elFileDecoder::WriteSingleStream(elMpegGenerator& gen)
+{
+    // Open the output and write it
+    std::ofstream outFile;
+    WriteMp3OrWave(OpenOutput(outFile, GenStreamFilename(0, 1)), gen, inputStream);
+}
+
+
+void elFileDecoder::WriteAllStreams(elMpegGenerator& gen)
+{
+    const unsigned int count = gen.GetStreamCount();
+    if (stdOutput)
+    {
+        if (count > 1)
         {
-            if (count == 1)
-            {
-                filename = GenOutputFilename((format("_part%i") % (currentPart + 1)).str());
-            }
-            else
-            {
-                filename = GenOutputFilename((format("_%ipart%i") % (i + 1) % (currentPart + 1)).str());
-            }
+            throw (runtime_error("Only one stream can be written to stdout, so pick one or use a multi-channel WAV."));
         }
+        WriteMp3OrWave(*stdOutput, gen, 0);
+        return;
+    }
+    
+    std::vector< shared_ptr<std::ofstream> > outFiles;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        // Get output file name
+        const std::string filename = GenStreamFilename(i, count);
         
-        // Open it and write it
-        std::ofstream outFile;
+        // Open it
+        shared_ptr<std::ofstream> outFile = make_shared<std::ofstream>();
         VERBOSE("Output file: " << filename);
-        outFile.open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
-        if (!outFile.is_open())
+        outFile->open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+        if (!outFile->is_open())
         {
             throw (runtime_error("Could not open output file '" + filename + "'."));
         }
-        
-        WriteMp3OrWave(outFile, gen, i);
+        outFiles.push_back(outFile);
     }
-}
-
-
-void elFileDecoder::WriteMultiWave(elMpegGenerator& gen)
-{
-    // Get output file name
-    std::string filename;
-    if (currentPart == 0)
+    
+    if (count == 1)
     {
-        filename = GenOutputFilename("");
+        WriteMp3OrWave(*outFiles[0], gen, 0);
+        return;
     }
-    else
+    
+    // Every stream has its own decoder and only reads from the generator, so
+    // they can all be written at once
+    std::vector<std::string> errors(count);
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < count; i++)
     {
-        filename = GenOutputFilename((format("_part%i") % (currentPart + 1)).str());
+        boost::function<void ()> task = boost::bind(&elFileDecoder::WriteMp3OrWave, this,
+            boost::ref(*outFiles[i]), boost::ref(gen), i);
+        threads.create_thread(boost::bind(&_RunTask, task, boost::ref(errors[i])));
     }
+    threads.join_all();
     
-    // Open it and write it
+    _ThrowFirstError(errors);
+}
+
+
+void elFileDecoder::WriteMultiWave(elMpegGenerator& gen)
+{
+    // Open the output
     std::ofstream outFile;
-    VERBOSE("Output file: " << filename);
-    outFile.open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
-    if (!outFile.is_open())
-    {
-        throw (runtime_error("Could not open output file '" + filename + "'."));
-    }
+    std::ostream& output = OpenOutput(outFile, GenStreamFilename(0, 1));
     
     // Create the streams
     std::vector< shared_ptr<elPcmOutputStream> > Streams;
@@ -433,7 +1159,7 @@ void elFileDecoder::WriteMultiWave(elMpegGenerator& gen)
     
     for (unsigned int i = 0; i < gen.GetStreamCount(); i++)
     {
-        Streams.push_back(gen.CreatePcmStream(i));
+        Streams.push_back(CreatePcmStream(gen, i));
         ChannelCount += gen.GetChannels(i);
     }
     
@@ -443,51 +1169,66 @@ void elFileDecoder::WriteMultiWave(elMpegGenerator& gen)
     }
     
     // Allocate a buffer
-    shared_array<short> ReadBuffer(new short[ChannelCount *
-    elPcmOutputStream::RecommendBufferSize()]);
-    const unsigned int PcmBufferSamples = elPcmOutputStream::RecommendBufferSize();
-    shared_array<short> PcmBuffer(new short[PcmBufferSamples]);
+    const unsigned int PcmBufferFrames = elPcmOutputStream::RecommendBufferSize();
+    shared_array<short> ReadBuffer(new short[ChannelCount * PcmBufferFrames]);
     
-    // Prepare the wave
-    PrepareWaveHeader(outFile);
+    // Write the header for the length the first stream should have, which
+    // sets the length of the rest
+    const unsigned long Expected = Streams[0]->GetSamplesLeft() / Streams[0]->GetChannels() * ChannelCount;
+    WriteWaveHeader(output, gen.GetSampleRate(0), 16, ChannelCount, Expected);
+    unsigned long Written = 0;
     
-    // Decode
-    while (!Streams[0]->Eos())
+    // Decode every stream on its own thread and interleave them here
+    elPcmStreamDecoders Decoders(Streams, PcmBufferFrames);
+    const unsigned int StreamCount = Streams.size();
+    std::vector<elPcmChunk> Chunks(StreamCount);
+    std::vector<const short*> Inputs(StreamCount);
+    std::vector<unsigned int> Channels(StreamCount);
+    for (unsigned int i = 0; i < StreamCount; i++)
     {
-        unsigned int Ch = 0;
-        unsigned int Frames = 0;
-        
-        for (unsigned int i = 0; i < gen.GetStreamCount(); i++)
+        Channels[i] = Streams[i]->GetChannels();
+    }
+    VERBOSE("Interleaving the streams with " << GetInterleaveInstructionSet());
+    
+    while (Decoders.Pop(0, Chunks[0]))
+    {
+        // The first stream sets the length, the others are cut or filled with silence to match it.
+        // Only the last chunk of a stream can be short, so this doesn't move the streams apart.
+        const unsigned int Frames = Chunks[0].count / Channels[0];
+        for (unsigned int i = 1; i < StreamCount; i++)
         {
-            unsigned int Read;
-            Read = Streams[i]->Read(PcmBuffer.get(), PcmBufferSamples);
-            Frames = Read / Streams[i]->GetChannels();
-            
-            unsigned int OldCh = Ch;
-            
-            for (unsigned int j = 0; j < Frames; j++)
+            elPcmChunk& Chunk = Chunks[i];
+            if (!Decoders.Pop(i, Chunk))
             {
-                Ch = OldCh;
-                
-                for (unsigned int k = 0; k < Streams[i]->GetChannels(); k++)
+                if (!Chunk.samples)
                 {
-                    ReadBuffer[j * ChannelCount + Ch] = PcmBuffer[j * Streams[i]->GetChannels() + k];
-                    Ch++;
+                    Chunk.samples.reset(new short[PcmBufferFrames * Channels[i]]);
                 }
+                Chunk.count = 0;
+            }
+            if (Chunk.count < Frames * Channels[i])
+            {
+                memset(Chunk.samples.get() + Chunk.count, 0, (Frames * Channels[i] - Chunk.count) * sizeof(short));
             }
         }
         
-        outFile.write((char*) ReadBuffer.get(), Frames * ChannelCount * sizeof(short));
+        for (unsigned int i = 0; i < StreamCount; i++)
+        {
+            Inputs[i] = Chunks[i].samples.get();
+        }
+        InterleaveStreams(ReadBuffer.get(), &Inputs[0], &Channels[0], StreamCount, Frames);
+        
+        output.write((char*) ReadBuffer.get(), Frames * ChannelCount * sizeof(short));
+        Written += Frames * ChannelCount;
     }
     
-    const unsigned int SampleCount = ((unsigned int) outFile.tellp() - 44) / 2;
-    outFile.seekp(0);
-    WriteWaveHeader(outFile, gen.GetSampleRate(0), 16,
-                    ChannelCount, SampleCount);
+    Decoders.Finish();
+    
+    FinishWave(output, gen.GetSampleRate(0), ChannelCount, Expected, Written);
 }
 
 
-void elFileDecoder::WriteMp3OrWave(std::ofstream& output, elMpegGenerator& gen, unsigned int index)
+void elFileDecoder::WriteMp3OrWave(std::ostream& output, elMpegGenerator& gen, unsigned int index)
 {
     switch (outputFormat)
     {
@@ -501,7 +1242,7 @@ void elFileDecoder::WriteMp3OrWave(std::ofstream& output, elMpegGenerator& gen,
 }
 
 
-void elFileDecoder::WriteMp3(std::ofstream& output, elMpegGenerator& gen, unsigned int index)
+void elFileDecoder::WriteMp3(std::ostream& output, elMpegGenerator& gen, unsigned int index)
 {
     // Create our buffer
     const unsigned int mpegBufferSize = MAX_MPEG_FRAME_BUFFER;
@@ -519,28 +1260,77 @@ void elFileDecoder::WriteMp3(std::ofstream& output, elMpegGenerator& gen, unsign
 }
 
 
-void elFileDecoder::WriteWave(std::ofstream& output, elMpegGenerator& gen, unsigned int index)
+void elFileDecoder::WriteWave(std::ostream& output, elMpegGenerator& gen, unsigned int index)
 {
+    const unsigned int threads = GetSegmentThreads(gen, index);
+    if (threads > 1)
+    {
+        WriteWaveSegments(output, gen, index, threads);
+        return;
+    }
+    
     // Create our buffer
     const unsigned int pcmBufferSamples = elPcmOutputStream::RecommendBufferSize();
     shared_array<short> pcmBuffer(new short[pcmBufferSamples]);
 
-    // Create our stream and prepare the wave header
-    shared_ptr<elPcmOutputStream> stream = gen.CreatePcmStream(index);
-    PrepareWaveHeader(output);
+    // Create our stream and write the header for the length it should have
+    shared_ptr<elPcmOutputStream> stream = CreatePcmStream(gen, index);
+    const unsigned long expected = stream->GetSamplesLeft();
+    WriteWaveHeader(output, gen.GetSampleRate(index), 16, gen.GetChannels(index), expected);
     
     // Write the data
+    unsigned long written = 0;
     while (!stream->Eos())
     {
         unsigned int lastRead;
         lastRead = stream->Read(pcmBuffer.get(), pcmBufferSamples);
         output.write((char*) pcmBuffer.get(), lastRead * sizeof(short));
+        written += lastRead;
+    }
+    
+    FinishWave(output, gen.GetSampleRate(index), gen.GetChannels(index), expected, written);
+}
+
+
+unsigned int elFileDecoder::GetSegmentThreads(const elMpegGenerator& gen, unsigned int index) const
+{
+    // Ranges are short, and the streams of a file written at the same time
+    // already have a thread each
+    if (HasRange() || (inputStream == -1 && gen.GetStreamCount() > 1) ||
+        gen.GetFrameCount(index) < 2 * PCM_SEGMENT_FRAMES)
+    {
+        return 1;
     }
     
-    const unsigned int sampleCount = ((unsigned int) output.tellp() - 44) / 2;
+    const unsigned int threads = this->decodeThreads ? this->decodeThreads : boost::thread::hardware_concurrency();
+    return std::min(threads, gen.GetFrameCount(index) / PCM_SEGMENT_FRAMES);
+}
+
+
+void elFileDecoder::WriteWaveSegments(std::ostream& output, elMpegGenerator& gen, unsigned int index,
+    unsigned int threads)
+{
+    // Write the header for the length the whole stream would have
+    const unsigned int channels = gen.GetChannels(index);
+    const unsigned long expected = gen.GetSampleFrameCount() * channels;
+    WriteWaveHeader(output, gen.GetSampleRate(index), 16, channels, expected);
+    VERBOSE("Decoding the stream in segments on " << threads << " threads");
     
-    // Now write the final wave header
-    output.seekp(0);
-    WriteWaveHeader(output, gen.GetSampleRate(index), 16,
-                    gen.GetChannels(index), sampleCount);
+    // Write the segments as they come in, cut to the same length
+    unsigned long written = 0;
+    elPcmSegmentDecoders decoders(gen, index, threads);
+    std::vector<short> samples;
+    while (decoders.Pop(samples))
+    {
+        const unsigned long count = std::min<unsigned long>(samples.size(), expected - written);
+        if (count > 0)
+        {
+            output.write((char*) &samples[0], count * sizeof(short));
+        }
+        written += count;
+    }
+    
+    decoders.Finish();
+    
+    FinishWave(output, gen.GetSampleRate(index), channels, expected, written);
 }
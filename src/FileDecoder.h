@@ -6,9 +6,12 @@
 
 #pragma once
 
+#include "Internal.h"
 #include <string>
 
 class elMpegGenerator;
+class elPcmOutputStream;
+class elDecodeIndex;
 
 class elFileDecoder
 {
@@ -32,8 +35,16 @@ public:
         P_VERSION6
     };
     
+    enum Unit
+    {
+        U_SAMPLES,
+        U_MILLISECONDS
+    };
+    
     /**
      * Set the input filename and the offset in the input stream to start at.
+     * With STDIN_FILENAME the input is read from stdin. Inputs that can't seek,
+     * like stdin, are read forwards only and can't be indexed.
      */
     void SetInput(const std::string& filename, std::streamoff offset = 0);
     
@@ -42,6 +53,15 @@ public:
      */
     const std::string& GetInput() const;
     
+    std::streamoff GetInputOffset() const;
+    
+    /**
+     * Is the input read from stdin?
+     */
+    bool ReadsFromStdin() const;
+    
+    static const char* const STDIN_FILENAME;
+    
     /**
      * Set which stream will be decoded. Use -1 to decode all.
      */
@@ -55,6 +75,8 @@ public:
     
     /**
      * Set the base output filename as well as the format to try to write to.
+     * With STDOUT_FILENAME the output is written to stdout instead, which only
+     * works for one output file and only decodes the first part of the input.
      */
     void SetOutput(const std::string& baseFilename, Format format = F_AUTO);
     
@@ -63,11 +85,54 @@ public:
      */
     const std::string& GetOutputFilename() const;
     
+    /**
+     * Is the output written to stdout?
+     */
+    bool WritesToStdout() const;
+    
+    static const char* const STDOUT_FILENAME;
+    
     /**
      * Return the output format.
      */
     Format GetOutputFormat() const;
     
+    /**
+     * Write MP3 frames while the input is parsed, so memory use stays flat
+     * regardless of the input size. Only used for MP3 output.
+     */
+    void SetStreaming(bool streaming);
+    
+    bool GetStreaming() const;
+    
+    /**
+     * Keep an index of the input's blocks next to it (see elDecodeIndex). An
+     * index that still matches the input is loaded, otherwise a new one is
+     * written once the input has been read.
+     */
+    void SetIndexing(bool indexing);
+    
+    bool GetIndexing() const;
+    
+    /**
+     * Only decode length sample frames or milliseconds from start, or to the
+     * end if length is 0. WAV output is cut at the exact sample frames, MP3
+     * output gets the whole blocks holding the range. Only the first part of
+     * the input is decoded.
+     */
+    void SetRange(unsigned long start, Unit startUnit, unsigned long length, Unit lengthUnit);
+    
+    bool HasRange() const;
+    
+    /**
+     * Set how many threads the blocks of an input are parsed on, and how many
+     * a long stream written to a WAV file may be decoded on, split into
+     * segments. 0 uses one per CPU, 1 turns both off.
+     */
+    void SetDecodeThreads(unsigned int threads);
+    
+    unsigned int GetDecodeThreads() const;
+    
     // TODO add a class to force a certain parser
     
     /**
@@ -83,19 +148,41 @@ private:
     Parser inputParser;
     std::string outputFilename;
     Format outputFormat;
+    bool streaming;
+    bool indexing;
+    unsigned long rangeStart;
+    Unit rangeStartUnit;
+    unsigned long rangeLength;
+    Unit rangeLengthUnit;
+    unsigned int decodeThreads;
     
 private:
     int currentPart;
-    
-    void ProcessPart(std::ifstream& input);
+    shared_ptr<elDecodeIndex> index;
+    shared_ptr<elDecodeIndex> newIndex;
+    unsigned long pcmSkip;
+    unsigned long pcmCount;
+    std::ostream* stdOutput;
+    
+    bool HasMoreInput(std::istream& input, std::streamoff fileSize) const;
+    void OpenIndex();
+    void SaveIndex();
+    void ProcessPart(std::istream& input);
     void AutoSetOutputFormat();
     std::string GenOutputFilename(const std::string& append) const;
+    std::string GenStreamFilename(unsigned int index, unsigned int count) const;
+    shared_ptr<elPcmOutputStream> CreatePcmStream(elMpegGenerator& gen, unsigned int index) const;
+    std::ostream& OpenOutput(std::ofstream& file, const std::string& filename) const;
+    void FinishWave(std::ostream& output, unsigned int sampleRate, unsigned int channels,
+        unsigned long expected, unsigned long written) const;
     void WriteSingleStream(elMpegGenerator& gen);
     void WriteAllStreams(elMpegGenerator& gen);
     void WriteMultiWave(elMpegGenerator& gen);
-    void WriteMp3OrWave(std::ofstream& output, elMpegGenerator& gen, unsigned int index);
-    void WriteMp3(std::ofstream& output, elMpegGenerator& gen, unsigned int index);
-    void WriteWave(std::ofstream& output, elMpegGenerator& gen, unsigned int index);
+    void WriteMp3OrWave(std::ostream& output, elMpegGenerator& gen, unsigned int index);
+    void WriteMp3(std::ostream& output, elMpegGenerator& gen, unsigned int index);
+    void WriteWave(std::ostream& output, elMpegGenerator& gen, unsigned int index);
+    unsigned int GetSegmentThreads(const elMpegGenerator& gen, unsigned int index) const;
+    void WriteWaveSegments(std::ostream& output, elMpegGenerator& gen, unsigned int index, unsigned int threads);
 };
 
 
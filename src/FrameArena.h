@@ -0,0 +1,103 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#pragma once
+
+#include "Internal.h"
+
+#define FRAME_ARENA_CHUNK_SIZE (64 * 1024)
+
+
+/// An append-only store for the bytes of many small frames. Frames are addressed by
+/// their offset from the start of the arena and never straddle two chunks, so the
+/// chunks never have to be moved around when the arena grows.
+class elFrameArena
+{
+public:
+    inline elFrameArena() :
+        m_FirstChunk(0),
+        m_End(0)
+    {
+        return;
+    }
+
+    /// Make room for a frame of up to MaxSize bytes at the end and return its offset.
+    inline unsigned long Begin(unsigned int MaxSize)
+    {
+        assert(MaxSize <= FRAME_ARENA_CHUNK_SIZE);
+
+        // Skip to the next chunk if the frame won't fit in this one
+        if (m_End % FRAME_ARENA_CHUNK_SIZE + MaxSize > FRAME_ARENA_CHUNK_SIZE)
+        {
+            m_End += FRAME_ARENA_CHUNK_SIZE - m_End % FRAME_ARENA_CHUNK_SIZE;
+        }
+
+        // Allocate the chunk if we don't have it yet
+        if (m_End / FRAME_ARENA_CHUNK_SIZE - m_FirstChunk >= m_Chunks.size())
+        {
+            m_Chunks.push_back(shared_array<uint8_t>(new uint8_t[FRAME_ARENA_CHUNK_SIZE]));
+        }
+        return m_End;
+    }
+
+    /// Keep Size bytes of the frame last started at Offset.
+    inline void Commit(unsigned long Offset, unsigned int Size)
+    {
+        assert(Offset == m_End);
+        assert(Offset % FRAME_ARENA_CHUNK_SIZE + Size <= FRAME_ARENA_CHUNK_SIZE);
+
+        m_End = Offset + Size;
+        return;
+    }
+
+    inline uint8_t* Get(unsigned long Offset)
+    {
+        assert(Offset / FRAME_ARENA_CHUNK_SIZE >= m_FirstChunk);
+        assert(Offset / FRAME_ARENA_CHUNK_SIZE - m_FirstChunk < m_Chunks.size());
+
+        return m_Chunks[Offset / FRAME_ARENA_CHUNK_SIZE - m_FirstChunk].get() + Offset % FRAME_ARENA_CHUNK_SIZE;
+    }
+
+    inline const uint8_t* Get(unsigned long Offset) const
+    {
+        assert(Offset / FRAME_ARENA_CHUNK_SIZE >= m_FirstChunk);
+        assert(Offset / FRAME_ARENA_CHUNK_SIZE - m_FirstChunk < m_Chunks.size());
+
+        return m_Chunks[Offset / FRAME_ARENA_CHUNK_SIZE - m_FirstChunk].get() + Offset % FRAME_ARENA_CHUNK_SIZE;
+    }
+
+    /// Free the chunks that only hold frames before Offset. Offsets stay valid.
+    inline void Discard(unsigned long Offset)
+    {
+        assert(Offset <= m_End);
+
+        while (m_Chunks.size() > 1 && (m_FirstChunk + 1) * FRAME_ARENA_CHUNK_SIZE <= Offset)
+        {
+            m_Chunks.pop_front();
+            m_FirstChunk++;
+        }
+        return;
+    }
+
+    inline void Clear()
+    {
+        m_Chunks.clear();
+        m_FirstChunk = 0;
+        m_End = 0;
+        return;
+    }
+
+    /// The offset one past the last committed byte.
+    inline unsigned long GetEnd() const
+    {
+        return m_End;
+    }
+
+protected:
+    std::deque< shared_array<uint8_t> > m_Chunks;
+    unsigned long m_FirstChunk;
+    unsigned long m_End;
+};
@@ -123,50 +123,46 @@ void elGenerator::WriteGranuleWithUncSamples(bsBitstream& OS, const elGranule& G
 
 void elGenerator::WriteGranule(bsBitstream& OS, const elGranule& Gr)
 {
+    bsBitWriter Writer(OS);
+
     // Write some fields out
-    OS.WriteBits(Gr.Version, 2);
-    OS.WriteBits(Gr.SampleRateIndex, 2);
-    OS.WriteBits(Gr.ChannelMode, 2);
-    OS.WriteBits(Gr.ModeExtension, 2);
-    OS.WriteBit(Gr.Index);
+    Writer.WriteBits(Gr.Version, 2);
+    Writer.WriteBits(Gr.SampleRateIndex, 2);
+    Writer.WriteBits(Gr.ChannelMode, 2);
+    Writer.WriteBits(Gr.ModeExtension, 2);
+    Writer.WriteBit(Gr.Index);
 
     // Write out scfsi
     if (Gr.Index == 1 && Gr.Version == MV_1)
     {
         for (unsigned int i = 0; i < Gr.Channels; i++)
         {
-            OS.WriteBits(Gr.ChannelInfo[i].Scfsi, 4);
+            Writer.WriteBits(Gr.ChannelInfo[i].Scfsi, 4);
         }
     }
 
     // Write out the side info
     for (unsigned int i = 0; i < Gr.Channels; i++)
     {
-        OS.WriteBits(Gr.ChannelInfo[i].Size, 12);
-        OS.WriteBits(Gr.ChannelInfo[i].SideInfo[0], 32);
+        Writer.WriteBits(Gr.ChannelInfo[i].Size, 12);
+        Writer.WriteBits(Gr.ChannelInfo[i].SideInfo[0], 32);
         if (Gr.Version == MV_1)
         {
-            OS.WriteBits(Gr.ChannelInfo[i].SideInfo[1], 47 - 32);
+            Writer.WriteBits(Gr.ChannelInfo[i].SideInfo[1], 47 - 32);
         }
         else
         {
-            OS.WriteBits(Gr.ChannelInfo[i].SideInfo[1], 51 - 32);
+            Writer.WriteBits(Gr.ChannelInfo[i].SideInfo[1], 51 - 32);
         }
     }
 
     // Write out the data
-    unsigned long BitsLeft = Gr.DataSizeBits;
-    if (BitsLeft > 0)
+    if (Gr.DataSizeBits > 0)
     {
-        bsBitstream IS(Gr.Data.get(), BitsLeft);
-
-        while (BitsLeft)
-        {
-            unsigned int ToWrite = min(32, BitsLeft);
-            OS.WriteBits(IS.ReadBits(ToWrite), ToWrite);
-            BitsLeft -= ToWrite;
-        }
+        Writer.CopyBits(Gr.Data.get(), Gr.DataOffset, Gr.DataSizeBits);
     }
+    Writer.Flush();
+    OS.SeekAbsolute(Writer.Tell());
     return;
 }
 
@@ -0,0 +1,331 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#include "Internal.h"
+#include "Interleave.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define INTERLEAVE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 in functions that ask for it
+#if defined(__GNUC__)
+#define INTERLEAVE_AVX2 __attribute__((target("avx2")))
+#define INTERLEAVE_SSE2 __attribute__((target("sse2")))
+#else
+#define INTERLEAVE_AVX2
+#define INTERLEAVE_SSE2
+#endif
+
+
+enum elInterleaveLevel
+{
+    IL_SCALAR,
+    IL_SSE2,
+    IL_AVX2
+};
+
+
+/**
+ * Works out the best instruction set the processor and the OS both support.
+ */
+static elInterleaveLevel _DetectLevel()
+{
+#if defined(INTERLEAVE_X86) && defined(_MSC_VER)
+    int Info[4];
+    __cpuid(Info, 0);
+    const int MaxLeaf = Info[0];
+    __cpuid(Info, 1);
+    const bool Sse2 = (Info[3] & (1 << 26)) != 0;
+    const bool Avx = (Info[2] & (1 << 28)) != 0;
+    const bool OsSaves = (Info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    bool Avx2 = false;
+    if (MaxLeaf >= 7)
+    {
+        __cpuidex(Info, 7, 0);
+        Avx2 = (Info[1] & (1 << 5)) != 0;
+    }
+    if (Avx && OsSaves && Avx2)
+    {
+        return IL_AVX2;
+    }
+    return Sse2 ? IL_SSE2 : IL_SCALAR;
+#elif defined(INTERLEAVE_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return IL_AVX2;
+    }
+    return __builtin_cpu_supports("sse2") ? IL_SSE2 : IL_SCALAR;
+#else
+    return IL_SCALAR;
+#endif
+}
+
+static const elInterleaveLevel g_InterleaveLevel = _DetectLevel();
+
+
+/**
+ * Interleaves any layout one sample at a time, starting at sample frame First.
+ */
+static void _InterleaveScalar(short* Output, const short* const* Inputs, const unsigned int* Channels,
+                              unsigned int StreamCount, unsigned int First, unsigned int Frames)
+{
+    unsigned int OutputChannels = 0;
+    for (unsigned int i = 0; i < StreamCount; i++)
+    {
+        OutputChannels += Channels[i];
+    }
+
+    unsigned int Channel = 0;
+    for (unsigned int i = 0; i < StreamCount; i++)
+    {
+        const unsigned int StreamChannels = Channels[i];
+        const short* In = Inputs[i] + First * StreamChannels;
+        short* Out = Output + First * OutputChannels + Channel;
+        for (unsigned int j = First; j < Frames; j++)
+        {
+            for (unsigned int k = 0; k < StreamChannels; k++)
+            {
+                Out[k] = In[k];
+            }
+            In += StreamChannels;
+            Out += OutputChannels;
+        }
+        Channel += StreamChannels;
+    }
+    return;
+}
+
+
+#ifdef INTERLEAVE_X86
+
+// Two mono streams, 8 sample frames at a time
+INTERLEAVE_SSE2 static unsigned int _Interleave1x2Sse2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 8 <= Frames; j += 8)
+    {
+        const __m128i A = _mm_loadu_si128((const __m128i*)(Inputs[0] + j));
+        const __m128i B = _mm_loadu_si128((const __m128i*)(Inputs[1] + j));
+        _mm_storeu_si128((__m128i*)(Output + j * 2), _mm_unpacklo_epi16(A, B));
+        _mm_storeu_si128((__m128i*)(Output + j * 2 + 8), _mm_unpackhi_epi16(A, B));
+    }
+    return j;
+}
+
+// Two stereo streams, 4 sample frames at a time
+INTERLEAVE_SSE2 static unsigned int _Interleave2x2Sse2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 4 <= Frames; j += 4)
+    {
+        const __m128i A = _mm_loadu_si128((const __m128i*)(Inputs[0] + j * 2));
+        const __m128i B = _mm_loadu_si128((const __m128i*)(Inputs[1] + j * 2));
+        _mm_storeu_si128((__m128i*)(Output + j * 4), _mm_unpacklo_epi32(A, B));
+        _mm_storeu_si128((__m128i*)(Output + j * 4 + 8), _mm_unpackhi_epi32(A, B));
+    }
+    return j;
+}
+
+// Three stereo streams, 4 sample frames at a time
+INTERLEAVE_SSE2 static unsigned int _Interleave2x3Sse2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 4 <= Frames; j += 4)
+    {
+        const __m128i A = _mm_loadu_si128((const __m128i*)(Inputs[0] + j * 2));
+        const __m128i B = _mm_loadu_si128((const __m128i*)(Inputs[1] + j * 2));
+        const __m128i C = _mm_loadu_si128((const __m128i*)(Inputs[2] + j * 2));
+
+        // Treating each stereo sample frame as one 32-bit lane, pick a0 b0 c0 a1 | b1 c1 a2 b2 | c2 a3 b3 c3
+        const __m128 AbLo = _mm_castsi128_ps(_mm_unpacklo_epi32(A, B));
+        const __m128 AbHi = _mm_castsi128_ps(_mm_unpackhi_epi32(A, B));
+        const __m128 BcLo = _mm_castsi128_ps(_mm_unpacklo_epi32(B, C));
+        const __m128 BcHi = _mm_castsi128_ps(_mm_unpackhi_epi32(B, C));
+        const __m128 CaLo = _mm_castsi128_ps(_mm_unpacklo_epi32(C, A));
+        const __m128 CaHi = _mm_castsi128_ps(_mm_unpackhi_epi32(C, A));
+
+        short* Out = Output + j * 6;
+        _mm_storeu_si128((__m128i*)Out, _mm_castps_si128(_mm_shuffle_ps(AbLo, CaLo, _MM_SHUFFLE(3, 0, 1, 0))));
+        _mm_storeu_si128((__m128i*)(Out + 8), _mm_castps_si128(_mm_shuffle_ps(BcLo, AbHi, _MM_SHUFFLE(1, 0, 3, 2))));
+        _mm_storeu_si128((__m128i*)(Out + 16), _mm_castps_si128(_mm_shuffle_ps(CaHi, BcHi, _MM_SHUFFLE(3, 2, 3, 0))));
+    }
+    return j;
+}
+
+// Four stereo streams, 4 sample frames at a time (a 4x4 transpose of 32-bit lanes)
+INTERLEAVE_SSE2 static unsigned int _Interleave2x4Sse2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 4 <= Frames; j += 4)
+    {
+        const __m128i A = _mm_loadu_si128((const __m128i*)(Inputs[0] + j * 2));
+        const __m128i B = _mm_loadu_si128((const __m128i*)(Inputs[1] + j * 2));
+        const __m128i C = _mm_loadu_si128((const __m128i*)(Inputs[2] + j * 2));
+        const __m128i D = _mm_loadu_si128((const __m128i*)(Inputs[3] + j * 2));
+        const __m128i AbLo = _mm_unpacklo_epi32(A, B);
+        const __m128i AbHi = _mm_unpackhi_epi32(A, B);
+        const __m128i CdLo = _mm_unpacklo_epi32(C, D);
+        const __m128i CdHi = _mm_unpackhi_epi32(C, D);
+
+        short* Out = Output + j * 8;
+        _mm_storeu_si128((__m128i*)Out, _mm_unpacklo_epi64(AbLo, CdLo));
+        _mm_storeu_si128((__m128i*)(Out + 8), _mm_unpackhi_epi64(AbLo, CdLo));
+        _mm_storeu_si128((__m128i*)(Out + 16), _mm_unpacklo_epi64(AbHi, CdHi));
+        _mm_storeu_si128((__m128i*)(Out + 24), _mm_unpackhi_epi64(AbHi, CdHi));
+    }
+    return j;
+}
+
+// The AVX2 versions do the same in each 128-bit lane, and then put the lanes in order
+
+INTERLEAVE_AVX2 static unsigned int _Interleave1x2Avx2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 16 <= Frames; j += 16)
+    {
+        const __m256i A = _mm256_loadu_si256((const __m256i*)(Inputs[0] + j));
+        const __m256i B = _mm256_loadu_si256((const __m256i*)(Inputs[1] + j));
+        const __m256i Lo = _mm256_unpacklo_epi16(A, B);
+        const __m256i Hi = _mm256_unpackhi_epi16(A, B);
+        _mm256_storeu_si256((__m256i*)(Output + j * 2), _mm256_permute2x128_si256(Lo, Hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(Output + j * 2 + 16), _mm256_permute2x128_si256(Lo, Hi, 0x31));
+    }
+    return j;
+}
+
+INTERLEAVE_AVX2 static unsigned int _Interleave2x2Avx2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 8 <= Frames; j += 8)
+    {
+        const __m256i A = _mm256_loadu_si256((const __m256i*)(Inputs[0] + j * 2));
+        const __m256i B = _mm256_loadu_si256((const __m256i*)(Inputs[1] + j * 2));
+        const __m256i Lo = _mm256_unpacklo_epi32(A, B);
+        const __m256i Hi = _mm256_unpackhi_epi32(A, B);
+        _mm256_storeu_si256((__m256i*)(Output + j * 4), _mm256_permute2x128_si256(Lo, Hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(Output + j * 4 + 16), _mm256_permute2x128_si256(Lo, Hi, 0x31));
+    }
+    return j;
+}
+
+INTERLEAVE_AVX2 static unsigned int _Interleave2x3Avx2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 8 <= Frames; j += 8)
+    {
+        const __m256i A = _mm256_loadu_si256((const __m256i*)(Inputs[0] + j * 2));
+        const __m256i B = _mm256_loadu_si256((const __m256i*)(Inputs[1] + j * 2));
+        const __m256i C = _mm256_loadu_si256((const __m256i*)(Inputs[2] + j * 2));
+        const __m256 AbLo = _mm256_castsi256_ps(_mm256_unpacklo_epi32(A, B));
+        const __m256 AbHi = _mm256_castsi256_ps(_mm256_unpackhi_epi32(A, B));
+        const __m256 BcLo = _mm256_castsi256_ps(_mm256_unpacklo_epi32(B, C));
+        const __m256 BcHi = _mm256_castsi256_ps(_mm256_unpackhi_epi32(B, C));
+        const __m256 CaLo = _mm256_castsi256_ps(_mm256_unpacklo_epi32(C, A));
+        const __m256 CaHi = _mm256_castsi256_ps(_mm256_unpackhi_epi32(C, A));
+        const __m256i O0 = _mm256_castps_si256(_mm256_shuffle_ps(AbLo, CaLo, _MM_SHUFFLE(3, 0, 1, 0)));
+        const __m256i O1 = _mm256_castps_si256(_mm256_shuffle_ps(BcLo, AbHi, _MM_SHUFFLE(1, 0, 3, 2)));
+        const __m256i O2 = _mm256_castps_si256(_mm256_shuffle_ps(CaHi, BcHi, _MM_SHUFFLE(3, 2, 3, 0)));
+
+        short* Out = Output + j * 6;
+        _mm256_storeu_si256((__m256i*)Out, _mm256_permute2x128_si256(O0, O1, 0x20));
+        _mm256_storeu_si256((__m256i*)(Out + 16), _mm256_permute2x128_si256(O2, O0, 0x30));
+        _mm256_storeu_si256((__m256i*)(Out + 32), _mm256_permute2x128_si256(O1, O2, 0x31));
+    }
+    return j;
+}
+
+INTERLEAVE_AVX2 static unsigned int _Interleave2x4Avx2(short* Output, const short* const* Inputs, unsigned int Frames)
+{
+    unsigned int j = 0;
+    for (; j + 8 <= Frames; j += 8)
+    {
+        const __m256i A = _mm256_loadu_si256((const __m256i*)(Inputs[0] + j * 2));
+        const __m256i B = _mm256_loadu_si256((const __m256i*)(Inputs[1] + j * 2));
+        const __m256i C = _mm256_loadu_si256((const __m256i*)(Inputs[2] + j * 2));
+        const __m256i D = _mm256_loadu_si256((const __m256i*)(Inputs[3] + j * 2));
+        const __m256i AbLo = _mm256_unpacklo_epi32(A, B);
+        const __m256i AbHi = _mm256_unpackhi_epi32(A, B);
+        const __m256i CdLo = _mm256_unpacklo_epi32(C, D);
+        const __m256i CdHi = _mm256_unpackhi_epi32(C, D);
+        const __m256i F0 = _mm256_unpacklo_epi64(AbLo, CdLo);
+        const __m256i F1 = _mm256_unpackhi_epi64(AbLo, CdLo);
+        const __m256i F2 = _mm256_unpacklo_epi64(AbHi, CdHi);
+        const __m256i F3 = _mm256_unpackhi_epi64(AbHi, CdHi);
+
+        short* Out = Output + j * 8;
+        _mm256_storeu_si256((__m256i*)Out, _mm256_permute2x128_si256(F0, F1, 0x20));
+        _mm256_storeu_si256((__m256i*)(Out + 16), _mm256_permute2x128_si256(F2, F3, 0x20));
+        _mm256_storeu_si256((__m256i*)(Out + 32), _mm256_permute2x128_si256(F0, F1, 0x31));
+        _mm256_storeu_si256((__m256i*)(Out + 48), _mm256_permute2x128_si256(F2, F3, 0x31));
+    }
+    return j;
+}
+
+#endif // INTERLEAVE_X86
+
+
+void InterleaveStreams(short* Output, const short* const* Inputs, const unsigned int* Channels,
+                       unsigned int StreamCount, unsigned int Frames)
+{
+    unsigned int Done = 0;
+
+#ifdef INTERLEAVE_X86
+    typedef unsigned int (*elKernel)(short*, const short* const*, unsigned int);
+    static const elKernel Sse2Kernels[] = { _Interleave1x2Sse2, _Interleave2x2Sse2, _Interleave2x3Sse2, _Interleave2x4Sse2 };
+    static const elKernel Avx2Kernels[] = { _Interleave1x2Avx2, _Interleave2x2Avx2, _Interleave2x3Avx2, _Interleave2x4Avx2 };
+
+    // Find out if it's one of the layouts that have a kernel
+    bool AllMono = true;
+    bool AllStereo = true;
+    for (unsigned int i = 0; i < StreamCount; i++)
+    {
+        AllMono = AllMono && Channels[i] == 1;
+        AllStereo = AllStereo && Channels[i] == 2;
+    }
+
+    int Layout = -1;
+    if (AllMono && StreamCount == 2)
+    {
+        Layout = 0;
+    }
+    else if (AllStereo && StreamCount >= 2 && StreamCount <= 4)
+    {
+        Layout = StreamCount - 1;
+    }
+
+    if (Layout >= 0 && g_InterleaveLevel == IL_AVX2)
+    {
+        Done = Avx2Kernels[Layout](Output, Inputs, Frames);
+    }
+    else if (Layout >= 0 && g_InterleaveLevel == IL_SSE2)
+    {
+        Done = Sse2Kernels[Layout](Output, Inputs, Frames);
+    }
+#endif
+
+    // Anything else, and the frames the kernel left over
+    _InterleaveScalar(Output, Inputs, Channels, StreamCount, Done, Frames);
+    return;
+}
+
+const char* GetInterleaveInstructionSet()
+{
+    switch (g_InterleaveLevel)
+    {
+        case IL_AVX2:
+            return "AVX2";
+        case IL_SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
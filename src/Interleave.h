@@ -0,0 +1,21 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#pragma once
+
+#include "Internal.h"
+
+/**
+ * Interleave Frames sample frames of StreamCount streams into Output, with the channels of
+ * each stream after the ones of the stream before it. Inputs[i] holds Frames interleaved
+ * sample frames of Channels[i] channels. The 1+1, 2+2, 2+2+2 and 2+2+2+2 layouts use SSE2
+ * or AVX2 when the processor has them.
+ */
+void InterleaveStreams(short* Output, const short* const* Inputs, const unsigned int* Channels,
+                       unsigned int StreamCount, unsigned int Frames);
+
+/// Get the name of the instruction set InterleaveStreams() uses.
+const char* GetInterleaveInstructionSet();
@@ -23,9 +23,23 @@ const std::string elAsfGstrLoader::GetName() const
     return "Asf GSTR Header";
 }
 
+bool elAsfGstrLoader::Sniff(const uint8_t* Header, unsigned int Size, std::streamoff /*Offset*/) const
+{
+    // An SCHl block starting with GSTR
+    if (Size >= 4 && memcmp(Header, "SCHl", 4) != 0)
+    {
+        return false;
+    }
+    if (Size >= 12 && memcmp(Header + 8, "GSTR", 4) != 0)
+    {
+        return false;
+    }
+    return true;
+}
+
 bool elAsfGstrLoader::Initialize(std::istream* Input)
 {
-    elBlockLoader::Initialize(Input);
+    elSCxLoader::Initialize(Input);
 
     char Signature[4];
     unsigned int BlockSize;
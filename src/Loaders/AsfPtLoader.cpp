@@ -23,9 +23,23 @@ const std::string elAsfPtLoader::GetName() const
     return "Asf PT Header";
 }
 
+bool elAsfPtLoader::Sniff(const uint8_t* Header, unsigned int Size, std::streamoff /*Offset*/) const
+{
+    // An SCHl block starting with PT
+    if (Size >= 4 && memcmp(Header, "SCHl", 4) != 0)
+    {
+        return false;
+    }
+    if (Size >= 10 && memcmp(Header + 8, "PT", 2) != 0)
+    {
+        return false;
+    }
+    return true;
+}
+
 bool elAsfPtLoader::Initialize(std::istream* Input)
 {
-    elBlockLoader::Initialize(Input);
+    elSCxLoader::Initialize(Input);
 
     char Signature[4];
     unsigned int BlockSize;
@@ -21,6 +21,9 @@ public:
     /// Initializes the loader, returning false if this file cannot be read by this loader.
     virtual bool Initialize(std::istream* Input);
 
+    /// Returns false if the first bytes of the input rule this format out.
+    virtual bool Sniff(const uint8_t* Header, unsigned int Size, std::streamoff Offset) const;
+
 protected:
     unsigned int m_BlockCount;
 };
@@ -25,6 +25,18 @@ const std::string elHeaderBLoader::GetName() const
     return "Header B";
 }
 
+bool elHeaderBLoader::Sniff(const uint8_t* Header, unsigned int Size, std::streamoff /*Offset*/) const
+{
+    // The same checks as Initialize()
+    if (Size < 5)
+    {
+        return true;
+    }
+    const uint8_t Compression = Header[4];
+    return Load16BE(Header) == 0x4800 && Load16BE(Header + 2) >= 8 &&
+        (Compression == 0x15 || Compression == 0x16);
+}
+
 bool elHeaderBLoader::Initialize(std::istream* Input)
 {
     elBlockLoader::Initialize(Input);
@@ -128,8 +140,7 @@ bool elHeaderBLoader::ReadNextBlock(elBlock& Block)
 
     BlockSize -= 8;
 
-    shared_array<uint8_t> Data(new uint8_t[BlockSize]);
-    m_Input->read((char*)Data.get(), BlockSize);
+    shared_array<uint8_t> Data = ReadBlockData(BlockSize);
 
     Block.Clear();
     Block.Data = Data;
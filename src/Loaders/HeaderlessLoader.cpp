@@ -27,6 +27,28 @@ const std::string elHeaderlessLoader::GetName() const
     return "Headerless";
 }
 
+bool elHeaderlessLoader::Sniff(const uint8_t* Header, unsigned int Size, std::streamoff /*Offset*/) const
+{
+    // Check the same block headers as Initialize() as far as the header goes
+    unsigned int Pos = 0;
+    for (unsigned int i = 0; i < 5 && Pos + 4 <= Size; i++)
+    {
+        const uint16_t Flags = Load16BE(Header + Pos);
+        const uint16_t BlockSize = Load16BE(Header + Pos + 2);
+
+        if (Flags & 0x8000)
+        {
+            break;
+        }
+        if ((Flags & 0x7FFF) || BlockSize < 8)
+        {
+            return false;
+        }
+        Pos += BlockSize;
+    }
+    return true;
+}
+
 bool elHeaderlessLoader::Initialize(std::istream* Input)
 {
     elBlockLoader::Initialize(Input);
@@ -120,8 +142,7 @@ bool elHeaderlessLoader::ReadNextBlock(elBlock& Block)
 
     BlockSize -= 8;
 
-    shared_array<uint8_t> Data(new uint8_t[BlockSize]);
-    m_Input->read((char*)Data.get(), BlockSize);
+    shared_array<uint8_t> Data = ReadBlockData(BlockSize);
 
     Block.Clear();
     Block.Data = Data;
@@ -8,7 +8,8 @@
 #include "SCxLoader.h"
 #include "../Parsers/ParserForSCx.h"
 
-elSCxLoader::elSCxLoader()
+elSCxLoader::elSCxLoader() :
+    m_InputEnd(0)
 {
     ClearHeaderFields();
     return;
@@ -19,32 +20,50 @@ elSCxLoader::~elSCxLoader()
     return;
 }
 
+bool elSCxLoader::Initialize(std::istream* Input)
+{
+    elBlockLoader::Initialize(Input);
+
+    // Measure the input once instead of for every block. A pipe can't be measured, which
+    // leaves the end at -1.
+    const std::streamoff StartOffset = m_Input->tellg();
+    m_Input->seekg(0, std::ios_base::end);
+    m_InputEnd = m_Input->tellg();
+    m_Input->clear();
+    m_Input->seekg(StartOffset);
+    return true;
+}
+
 bool elSCxLoader::ReadNextBlock(elBlock& Block)
 {
     if (!m_Input)
     {
         return false;
     }
-    if (m_Input->eof())
-    {
-        return false;
-    }
 
-    const std::streamoff Offset = m_Input->tellg();
-
-    // Read the block
+    std::streamoff Offset;
     char Signature[4];
     unsigned int BlockSize;
     shared_array<uint8_t> Data;
 
-    Data = ReadRawBlockFromInput(Signature, BlockSize);
-    if (memcmp(Signature, "SCEl", 4) == 0)
+    // Read blocks until we get some audio data
+    while (true)
     {
-        return false;
-    }
-    if (memcmp(Signature, "SCDl", 4) != 0)
-    {
-        return ReadNextBlock(Block);
+        if (!m_Input->good())
+        {
+            return false;
+        }
+
+        Offset = m_Input->tellg();
+        Data = ReadRawBlockFromInput(Signature, BlockSize);
+        if (memcmp(Signature, "SCEl", 4) == 0)
+        {
+            return false;
+        }
+        if (memcmp(Signature, "SCDl", 4) == 0)
+        {
+            break;
+        }
     }
     if (BlockSize < 12)
     {
@@ -74,8 +93,7 @@ bool elSCxLoader::ReadNextBlock(elBlock& Block)
     Block.Offset = Offset;
     Block.SampleCount = SampleFrames;
     Block.Size = BlockSize;
-    Block.Data = shared_array<uint8_t>(new uint8_t[BlockSize]);
-    memcpy(Block.Data.get(), Ptr, BlockSize);
+    Block.Data = shared_array<uint8_t>(Data, Ptr);
     return true;
 }
 
@@ -97,8 +115,11 @@ shared_array<uint8_t> elSCxLoader::ReadRawBlockFromInput(char* Type, unsigned in
         return shared_array<uint8_t>();
     }
 
-    m_Input->read(Type, 4);
-    m_Input->read((char*)&Size, 4);
+    // The type and the size are read in one go
+    char Header[8];
+    m_Input->read(Header, 8);
+    memcpy(Type, Header, 4);
+    memcpy(&Size, Header + 4, 4);
 
     if (Size <= 8)
     {
@@ -107,19 +128,13 @@ shared_array<uint8_t> elSCxLoader::ReadRawBlockFromInput(char* Type, unsigned in
     Size -= 8;
 
     const std::streamoff CurrentOffset = m_Input->tellg();
-    m_Input->seekg(0, std::ios_base::end);
-    const std::streamsize FileSize = m_Input->tellg();
-    m_Input->seekg(CurrentOffset);
-
-    if (Size > FileSize - CurrentOffset)
+    if (CurrentOffset < 0 || (m_InputEnd >= 0 && Size > m_InputEnd - CurrentOffset))
     {
         Size = 0;
         return shared_array<uint8_t>();
     }
 
-    shared_array<uint8_t> Data(new uint8_t[Size]);
-    m_Input->read((char*)Data.get(), Size);
-    return Data;
+    return ReadBlockData(Size);
 }
 
 static unsigned long ReadBytes(uint8_t*& Ptr, uint8_t Count)
@@ -15,6 +15,9 @@ public:
     elSCxLoader();
     virtual ~elSCxLoader();
 
+    /// Initializes the loader and measures the input. Call this first from the derived loaders.
+    virtual bool Initialize(std::istream* Input);
+
     /// Reads the next block from the file and updates the current block index.
     virtual bool ReadNextBlock(elBlock& Block);
     
@@ -44,4 +47,7 @@ protected:
     unsigned int m_BytesPerSample;
     unsigned int m_Split;
     unsigned int m_SplitCompression;
+
+    /// Where the input ends, for checking the block sizes, or -1 if it is not known.
+    std::streamoff m_InputEnd;
 };
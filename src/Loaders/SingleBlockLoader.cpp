@@ -26,6 +26,51 @@ const std::string elSingleBlockLoader::GetName() const
     return "Single Block Header";
 }
 
+bool elSingleBlockLoader::Sniff(const uint8_t* Header, unsigned int Size, std::streamoff Offset) const
+{
+    // The main part of a loop is checked against the start of the file, which we don't have
+    if (Offset != 0)
+    {
+        return true;
+    }
+    if (Size < 8)
+    {
+        return true;
+    }
+
+    const uint8_t Compression = Header[0];
+    const uint8_t ChannelValue = Header[1];
+    uint32_t TotalSamples = Load32BE(Header + 4);
+    uint32_t StartingPartSamples = 0;
+    unsigned int Pos = 8;
+    if ((TotalSamples & 0x20000000) != 0)
+    {
+        if (Size < 12)
+        {
+            return true;
+        }
+        StartingPartSamples = Load32BE(Header + 8);
+        Pos += 4;
+    }
+    TotalSamples = (TotalSamples & 0x1FFFFFFF);
+
+    // The same checks as Initialize(), except for the size of the file
+    if (Compression < 5 || Compression > 7 || ChannelValue % 4 != 0)
+    {
+        return false;
+    }
+    if (Size < Pos + 8)
+    {
+        return true;
+    }
+    const uint32_t FirstPartSamples = Load32BE(Header + Pos + 4);
+    if (StartingPartSamples == 0)
+    {
+        return TotalSamples == FirstPartSamples;
+    }
+    return StartingPartSamples == FirstPartSamples;
+}
+
 bool elSingleBlockLoader::Initialize(std::istream* Input)
 {
     elBlockLoader::Initialize(Input);
@@ -115,8 +160,10 @@ bool elSingleBlockLoader::Initialize(std::istream* Input)
         VERBOSE("L: single block loader incorrect because loop starting part samples don't equal first part samples");
         return false;
     }
+    // The size of a pipe isn't known, so it gets the benefit of the doubt
     m_Input->seekg(0, std::ios_base::end);
-    if (BlockSize + 8 > m_Input->tellg())
+    const std::streamoff InputEnd = m_Input->tellg();
+    if (InputEnd >= 0 && BlockSize + 8 > InputEnd)
     {
         VERBOSE("L: single block loader incorrect because of size");
         return false;
@@ -173,8 +220,7 @@ bool elSingleBlockLoader::ReadNextBlock(elBlock& Block)
     // Now load the data
     BlockSize -= 8;
 
-    shared_array<uint8_t> Data(new uint8_t[BlockSize]);
-    m_Input->read((char*)Data.get(), BlockSize);
+    shared_array<uint8_t> Data = ReadBlockData(BlockSize);
 
     Block.Clear();
     Block.Data = Data;
@@ -7,9 +7,11 @@
 #include "Internal.h"
 
 #include <fstream>
+#include <cctype>
 #include <boost/format.hpp>
 
 #include "FileDecoder.h"
+#include "BatchDecoder.h"
 
 #include "Version.h"
 #include "AllFormats.h"
@@ -68,6 +70,13 @@ struct SArguments
         OutputFormat(EOF_AUTO),
         OutputEALayer3(EOEA_HEADERLESS),
         OutputLoop(false),
+        Streaming(false),
+        Index(false),
+        Jobs(0),
+        Start(0),
+        StartUnit(elFileDecoder::U_SAMPLES),
+        Duration(0),
+        DurationUnit(elFileDecoder::U_SAMPLES),
 
         DecodeParser(elFileDecoder::P_AUTO),
         DecodeOutFormat(elFileDecoder::F_AUTO)
@@ -86,6 +95,13 @@ struct SArguments
     EOutputFormat OutputFormat;
     EOutputEALayer3 OutputEALayer3;
     bool OutputLoop;
+    bool Streaming;
+    bool Index;
+    unsigned int Jobs;
+    unsigned long Start;
+    elFileDecoder::Unit StartUnit;
+    unsigned long Duration;
+    elFileDecoder::Unit DurationUnit;
 
     elFileDecoder::Parser DecodeParser;
     elFileDecoder::Format DecodeOutFormat;
@@ -96,6 +112,7 @@ struct SArguments
 // Functions in this file
 void SeparateFilename(const std::string& Filename, std::string& PathAndName, std::string& Ext);
 bool ParseArguments(SArguments& Args, unsigned long Argc, char* Argv[]);
+bool ParsePosition(const char* Text, unsigned long& Value, elFileDecoder::Unit& Unit);
 void ShowUsage(const std::string& Program);
 bool OpenOutputFile(std::ofstream& Output, const std::string& Filename);
 int Encode(SArguments& Args);
@@ -187,6 +204,47 @@ bool ParseArguments(SArguments& Args, unsigned long Argc, char* Argv[])
             Args.OutputFormat = EOF_MP3;
             Args.DecodeOutFormat = elFileDecoder::F_MP3;
         }
+        else if (Arg == "--streaming")
+        {
+            Args.Streaming = true;
+        }
+        else if (Arg == "--index")
+        {
+            Args.Index = true;
+        }
+        else if (Arg == "-j" || Arg == "--jobs")
+        {
+            if (i >= Argc)
+            {
+                return false;
+            }
+
+            Args.Jobs = atoi(Argv[i++]);
+        }
+        else if (Arg == "--start")
+        {
+            if (i >= Argc)
+            {
+                return false;
+            }
+
+            if (!ParsePosition(Argv[i++], Args.Start, Args.StartUnit))
+            {
+                return false;
+            }
+        }
+        else if (Arg == "--duration")
+        {
+            if (i >= Argc)
+            {
+                return false;
+            }
+
+            if (!ParsePosition(Argv[i++], Args.Duration, Args.DurationUnit))
+            {
+                return false;
+            }
+        }
         else if (Arg == "-v" || Arg == "--verbose")
         {
             g_Verbose = 1;
@@ -231,16 +289,51 @@ bool ParseArguments(SArguments& Args, unsigned long Argc, char* Argv[])
     return true;
 }
 
+bool ParsePosition(const char* Text, unsigned long& Value, elFileDecoder::Unit& Unit)
+{
+    // strtoul() skips spaces and wraps negative numbers around, so only take digits
+    if (!isdigit((unsigned char)Text[0]))
+    {
+        std::cerr << "Invalid position '" << Text << "'." << std::endl;
+        return false;
+    }
+
+    char* End;
+    Value = strtoul(Text, &End, 10);
+    const std::string Suffix(End);
+    if (Suffix.empty())
+    {
+        Unit = elFileDecoder::U_SAMPLES;
+    }
+    else if (Suffix == "ms")
+    {
+        Unit = elFileDecoder::U_MILLISECONDS;
+    }
+    else
+    {
+        std::cerr << "Invalid position '" << Text << "', use a number of samples or milliseconds (as in 1500ms)." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
 void ShowUsage(const std::string& Program)
 {
     std::cout << "Usage: " << Program << " InputFilename [Options]" << std::endl;
+    std::cout << "  The input filename can be - to read from stdin." << std::endl;
     std::cout << std::endl;
     std::cout << "  -i, --offset Offset   Specify the offset in the file to begin at." << std::endl;
-    std::cout << "  -o, --output File     Specify the output filename (.mp3)." << std::endl;
+    std::cout << "  -o, --output File     Specify the output filename (.mp3), or - to write to stdout." << std::endl;
     std::cout << "  -s, --stream Index    Specify which stream to extract, or all." << std::endl;
     std::cout << "  -m, --mp3             Output to MP3 (no information loss!)." << std::endl;
     std::cout << "  -w, --wave            Output to Microsoft WAV." << std::endl;
     std::cout << "  -mc, --multi-wave     Output to a multi-channel Microsoft WAV." << std::endl;
+    std::cout << "  --streaming           Write MP3 frames while parsing, using less memory." << std::endl;
+    std::cout << "  --start Position      Start decoding at this sample (or millisecond with ms, as in 1500ms)." << std::endl;
+    std::cout << "  --duration Length     Only decode this many samples (or milliseconds with ms)." << std::endl;
+    std::cout << "  --index               Keep an index of the input next to it (input.idx) for seeking." << std::endl;
+    std::cout << "  -j, --jobs Count      Decode files on this many threads (default: one per CPU)." << std::endl;
     std::cout << "  --parser5             Force using the version 5 parser." << std::endl;
     std::cout << "  --parser6             Force using the version 6/7 parser." << std::endl;
     std::cout << "  -n, --info            Output information about the file." << std::endl;
@@ -255,6 +348,8 @@ void ShowUsage(const std::string& Program)
     std::cout << std::endl;
     std::cout << "If multiple input files are given, they will be be interleaved ";
     std::cout << "into multiple streams" << std::endl << std::endl;
+    std::cout << "Decoding many files: " << Program << " InputFile|Directory [...] [Options]" << std::endl;
+    std::cout << "  Each file is decoded next to its input. Directories are searched recursively." << std::endl << std::endl;
     std::cout << "Supported formats: " << std::endl;
 
     // List supported formats
@@ -366,6 +461,31 @@ int main(int Argc, char** Argv)
         }
 
         decoder.SetOutput(Args.OutputFilename, Args.DecodeOutFormat);
+        decoder.SetStreaming(Args.Streaming);
+        decoder.SetIndexing(Args.Index);
+        decoder.SetRange(Args.Start, Args.StartUnit, Args.Duration, Args.DurationUnit);
+
+        // Decode many files at once
+        if (Args.InputFilenameVector.size() > 1 || elBatchDecoder::IsDirectory(Args.InputFilename))
+        {
+            if (!Args.OutputFilename.empty())
+            {
+                std::cerr << "An output filename can't be given when decoding more than one file." << std::endl;
+                return 1;
+            }
+
+            elBatchDecoder batch(decoder);
+            for (std::vector<std::string>::const_iterator Iter = Args.InputFilenameVector.begin();
+                Iter != Args.InputFilenameVector.end(); ++Iter)
+            {
+                batch.AddInput(*Iter);
+            }
+            batch.SetThreads(Args.Jobs);
+            return batch.Process() ? 1 : 0;
+        }
+
+        // One file gets all of the threads to itself
+        decoder.SetDecodeThreads(Args.Jobs);
         decoder.Process();
     }
     catch (elParserException& E)
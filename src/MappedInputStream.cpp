@@ -0,0 +1,227 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#include "Internal.h"
+#include "MappedInputStream.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+elMemoryStreamBuf::elMemoryStreamBuf() :
+    m_PastEnd(0)
+{
+    return;
+}
+
+elMemoryStreamBuf::~elMemoryStreamBuf()
+{
+    return;
+}
+
+void elMemoryStreamBuf::SetData(char* Data, std::streamsize Size)
+{
+    setg(Data, Data, Data + Size);
+    m_PastEnd = 0;
+    return;
+}
+
+elMemoryStreamBuf::pos_type elMemoryStreamBuf::seekoff(off_type Offset, std::ios_base::seekdir Dir, std::ios_base::openmode Which)
+{
+    if (!(Which & std::ios_base::in) || !eback())
+    {
+        return pos_type(off_type(-1));
+    }
+
+    const off_type Size = egptr() - eback();
+    off_type NewOffset;
+    switch (Dir)
+    {
+        case std::ios_base::beg:
+            NewOffset = Offset;
+            break;
+        case std::ios_base::cur:
+            NewOffset = gptr() - eback() + m_PastEnd + Offset;
+            break;
+        case std::ios_base::end:
+            NewOffset = Size + Offset;
+            break;
+        default:
+            return pos_type(off_type(-1));
+    }
+
+    if (NewOffset < 0)
+    {
+        return pos_type(off_type(-1));
+    }
+
+    // Past the end the reads hit the end of the file
+    if (NewOffset > Size)
+    {
+        setg(eback(), egptr(), egptr());
+        m_PastEnd = NewOffset - Size;
+    }
+    else
+    {
+        setg(eback(), eback() + NewOffset, egptr());
+        m_PastEnd = 0;
+    }
+    return pos_type(NewOffset);
+}
+
+elMemoryStreamBuf::pos_type elMemoryStreamBuf::seekpos(pos_type Position, std::ios_base::openmode Which)
+{
+    return seekoff(off_type(Position), std::ios_base::beg, Which);
+}
+
+std::streamsize elMemoryStreamBuf::showmanyc()
+{
+    if (gptr() == egptr())
+    {
+        return -1;
+    }
+    return egptr() - gptr();
+}
+
+
+/// Unmaps the file when the last array sharing it goes away.
+class elUnmapFile
+{
+public:
+    elUnmapFile(unsigned long Size) :
+        m_Size(Size)
+    {
+        return;
+    }
+
+    void operator()(uint8_t* Data) const
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(Data);
+#else
+        munmap(Data, m_Size);
+#endif
+        return;
+    }
+
+protected:
+    unsigned long m_Size;
+};
+
+
+elMappedInputStream::elMappedInputStream() :
+    std::istream(NULL),
+    m_Size(0)
+{
+    return;
+}
+
+elMappedInputStream::~elMappedInputStream()
+{
+    Close();
+    return;
+}
+
+bool elMappedInputStream::Open(const std::string& Filename)
+{
+    Close();
+
+    void* Data = NULL;
+    unsigned long Size = 0;
+
+#ifdef _WIN32
+    HANDLE File = CreateFileA(Filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (File == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER FileSize;
+    if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0 ||
+        FileSize.QuadPart != (unsigned long)FileSize.QuadPart)
+    {
+        CloseHandle(File);
+        return false;
+    }
+    Size = (unsigned long)FileSize.QuadPart;
+
+    HANDLE Mapping = CreateFileMappingA(File, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(File);
+    if (!Mapping)
+    {
+        return false;
+    }
+
+    Data = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(Mapping);
+    if (!Data)
+    {
+        return false;
+    }
+#else
+    const int File = open(Filename.c_str(), O_RDONLY);
+    if (File < 0)
+    {
+        return false;
+    }
+
+    // Only regular files can be mapped, pipes and such go through the fallback
+    struct stat Info;
+    if (fstat(File, &Info) != 0 || !S_ISREG(Info.st_mode) || Info.st_size <= 0 ||
+        Info.st_size != (off_t)(unsigned long)Info.st_size)
+    {
+        close(File);
+        return false;
+    }
+    Size = (unsigned long)Info.st_size;
+
+    Data = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, File, 0);
+    close(File);
+    if (Data == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(Data, Size, MADV_SEQUENTIAL);
+#endif
+
+    m_Mapping = shared_array<uint8_t>((uint8_t*)Data, elUnmapFile(Size));
+    m_Size = Size;
+    m_Buffer.SetData((char*)Data, Size);
+    rdbuf(&m_Buffer);
+    return true;
+}
+
+void elMappedInputStream::Close()
+{
+    rdbuf(NULL);
+    m_Buffer.SetData(NULL, 0);
+    m_Mapping.reset();
+    m_Size = 0;
+    return;
+}
+
+bool elMappedInputStream::IsOpen() const
+{
+    return m_Mapping.get() != NULL;
+}
+
+shared_array<uint8_t> elMappedInputStream::Share(std::streamoff Offset, unsigned long Size) const
+{
+    if (!m_Mapping || Offset < 0 || (unsigned long)Offset > m_Size || Size > m_Size - Offset)
+    {
+        return shared_array<uint8_t>();
+    }
+    return shared_array<uint8_t>(m_Mapping, m_Mapping.get() + Offset);
+}
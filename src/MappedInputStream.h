@@ -0,0 +1,57 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#pragma once
+
+#include "Internal.h"
+#include <istream>
+
+/// A stream buffer over a block of memory. Seeking past the end is allowed, like in a file.
+class elMemoryStreamBuf : public std::streambuf
+{
+public:
+    elMemoryStreamBuf();
+    virtual ~elMemoryStreamBuf();
+
+    /// Set the memory to read from, and go to the start of it.
+    void SetData(char* Data, std::streamsize Size);
+
+protected:
+    virtual pos_type seekoff(off_type Offset, std::ios_base::seekdir Dir, std::ios_base::openmode Which);
+    virtual pos_type seekpos(pos_type Position, std::ios_base::openmode Which);
+    virtual std::streamsize showmanyc();
+
+    /// How far the position is past the end of the data.
+    off_type m_PastEnd;
+};
+
+/**
+ * An input stream that reads a file through a read-only memory mapping. Reads and seeks
+ * don't need any system calls, and blocks can share the mapping instead of being copied.
+ */
+class elMappedInputStream : public std::istream
+{
+public:
+    elMappedInputStream();
+    virtual ~elMappedInputStream();
+
+    /// Map the file. Returns false if it can't be mapped, use a std::ifstream then.
+    bool Open(const std::string& Filename);
+
+    /// Unmap the file. Arrays from Share() stay valid.
+    void Close();
+
+    bool IsOpen() const;
+
+    /// Get Size bytes at Offset that point into the mapping and keep it alive.
+    /// Returns a null array if they aren't all in the file. The bytes are read-only.
+    shared_array<uint8_t> Share(std::streamoff Offset, unsigned long Size) const;
+
+protected:
+    elMemoryStreamBuf m_Buffer;
+    shared_array<uint8_t> m_Mapping;
+    unsigned long m_Size;
+};
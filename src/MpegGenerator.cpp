@@ -37,13 +37,20 @@ static const char* MpegChannelModeString[4] = {"stereo", "joint stereo", "dual c
 static const char* MpegModeExtensionString[4] = {"none", "intensity stereo", "MS stereo", "intensity stereo and MS stereo"};
 
 
+elMpegFrameSink::~elMpegFrameSink()
+{
+    return;
+}
+
 elMpegGenerator::elMpegGenerator() :
         m_CurrentFrame(0),
         m_UncompressedSampleFrames(0),
         m_SampleFrames(0),
         m_DoneParsingBlocks(false),
         m_CurMpegFrame(0),
-        m_CurOutputMpegFrame(0)
+        m_CurOutputMpegFrame(0),
+        m_Sink(NULL),
+        m_LookAhead(0)
 {
     return;
 }
@@ -56,12 +63,19 @@ elMpegGenerator::~elMpegGenerator()
 void elMpegGenerator::Clear()
 {
     m_Parser.reset();
+    m_FirstBlockData.reset();
+    m_FirstBlockStreams.clear();
+    m_ParsedStreams.clear();
     m_UncompressedSampleFrames = 0;
     m_StreamInfo.clear();
     m_DoneParsingBlocks = false;
     m_CurMpegFrame = 0;
     m_CurOutputMpegFrame = 0;
     m_Outputs.clear();
+    m_Sink = NULL;
+    m_LookAhead = 0;
+    m_VbrFrames.clear();
+    m_VbrFrameData.clear();
     return;
 }
 
@@ -85,8 +99,25 @@ bool elMpegGenerator::Initialize(const elBlock& FirstBlock, shared_ptr<elParser>
         return false;
     }
 
-    IS.SeekAbsolute(0);
-    ReadBlockData(Streams, IS);
+    // The probe only read the start of the block, so the parser it picked can still fail
+    while (true)
+    {
+        IS.SeekAbsolute(0);
+        Streams.clear();
+        try
+        {
+            ReadBlockData(Streams, IS, FirstBlock);
+            break;
+        }
+        catch (elParserException& E)
+        {
+            VERBOSE("G: the first block could not be parsed: " << E.what());
+            if (!m_Parser->UseRunnerUp())
+            {
+                return false;
+            }
+        }
+    }
 
     // Create a frame for each stream
     for (unsigned int i = 0; i < Streams.size(); i++)
@@ -104,11 +135,15 @@ bool elMpegGenerator::Initialize(const elBlock& FirstBlock, shared_ptr<elParser>
 
         // Add the stream to the outputs and create the VBR frame
         m_Outputs.push_back(elMpegStream());
-        m_Outputs.back().push_back(elMpegFrame());
-
-        elMpegFrame& VbrFrame = m_Outputs.back().back();
-        memset(VbrFrame.Data.get(), 0x11, MAX_MPEG_FRAME_BUFFER);
-        ConstructMpegVbrFrame(Streams[i][0].Gr, VbrFrame, 0, 0);
+        elMpegStream& Str = m_Outputs.back();
+        Str.Frames.push_back(elMpegFrame());
+
+        elMpegFrame& VbrFrame = Str.Frames.back();
+        VbrFrame.Offset = Str.Arena.Begin(MAX_MPEG_FRAME_BUFFER);
+        uint8_t* Data = Str.Arena.Get(VbrFrame.Offset);
+        memset(Data, 0x11, MAX_MPEG_FRAME_BUFFER);
+        ConstructMpegVbrFrame(Streams[i][0].Gr, VbrFrame, Data, 0, 0);
+        Str.Arena.Commit(VbrFrame.Offset, VbrFrame.Used);
     }
 
     // Make sure that there is at least one MPEG stream
@@ -125,6 +160,10 @@ bool elMpegGenerator::Initialize(const elBlock& FirstBlock, shared_ptr<elParser>
     m_CurMpegFrame = 1;
     m_CurOutputMpegFrame = 0;
     m_SampleFrames = 0;
+
+    // ParseBlock() will use this instead of parsing the first block again
+    m_FirstBlockData = FirstBlock.Data;
+    m_FirstBlockStreams.swap(Streams);
     return true;
 }
 
@@ -161,48 +200,211 @@ unsigned int elMpegGenerator::GetChannels(unsigned int StreamIndex) const
     return m_StreamInfo[StreamIndex].Channels;
 }
 
+unsigned int elMpegGenerator::GetParsedFrameCount(unsigned int StreamIndex) const
+{
+    if (StreamIndex >= m_StreamInfo.size())
+    {
+        return 0;
+    }
+    return m_StreamInfo[StreamIndex].FramesParsed;
+}
+
+unsigned int elMpegGenerator::GetParsedGranuleCount(unsigned int StreamIndex) const
+{
+    if (StreamIndex >= m_StreamInfo.size())
+    {
+        return 0;
+    }
+    return m_StreamInfo[StreamIndex].GranulesParsed;
+}
 
-void elMpegGenerator::ParseBlock(const elBlock& Block)
+void elMpegGenerator::SetStreaming(elMpegFrameSink* Sink, unsigned int LookAhead)
 {
-    // Sanity check
     if (m_DoneParsingBlocks)
     {
-        throw (elMpegGeneratorException("Already called DoneParsingBlocks(), can't parse any more blocks."));
+        throw (elMpegGeneratorException("Already called DoneParsingBlocks(), can't start streaming."));
+    }
+    m_Sink = Sink;
+    m_LookAhead = LookAhead > 0 ? LookAhead : 1;
+    m_VbrFrames.resize(m_Outputs.size());
+    m_VbrFrameData.resize(m_Outputs.size());
+    return;
+}
+
+void elMpegGenerator::ParseBlock(const elBlock& Block)
+{
+    ParseBlockFrames(Block, m_Streams, m_ParsedStreams);
+    AddParsedFrames(m_ParsedStreams, Block.SampleCount);
+    return;
+}
+
+void elMpegGenerator::ParseBlockFrames(const elBlock& Block, elStreamVector& Pending, elStreamVector& Parsed)
+{
+    VERY_VERBOSE("Block offset: " << Block.Offset << "; Block size: " << Block.Size << "; Sample count: " << Block.SampleCount);
+
+    // Read the block data, unless Initialize() already did
+    if (m_FirstBlockData && Block.Data == m_FirstBlockData && Pending.empty())
+    {
+        Pending.swap(m_FirstBlockStreams);
+        m_CurrentFrame += Pending[0].size();
+    }
+    else
+    {
+        bsBitstream IS(Block.Data.get(), Block.Size);
+        ReadBlockData(Pending, IS, Block);
     }
+    m_FirstBlockData.reset();
+    m_FirstBlockStreams.clear();
 
-    m_SampleFrames += Block.SampleCount;
+    TakeCompleteFrames(Pending, Parsed);
+    return;
+}
+
+shared_ptr<elParser> elMpegGenerator::CloneParser() const
+{
+    if (!m_Parser)
+    {
+        throw (elMpegGeneratorException("Initialize() wasn't called, there is no parser to copy."));
+    }
+    return m_Parser->Clone();
+}
+
+void elMpegGenerator::ParseBlockFragment(elParser& Parser, const elBlock& Block, elStreamVector& Fragment) const
+{
     VERY_VERBOSE("Block offset: " << Block.Offset << "; Block size: " << Block.Size << "; Sample count: " << Block.SampleCount);
 
-    // Read the block data
+    Fragment.clear();
     bsBitstream IS(Block.Data.get(), Block.Size);
-    ReadBlockData(m_Streams, IS);
+    Parser.Parse(Fragment, IS, Block.Data);
+    return;
+}
+
+void elMpegGenerator::MergeBlockFragment(elStreamVector& Fragment, elStreamVector& Pending, elStreamVector& Parsed)
+{
+    // Initialize() parsed the first block already, and the fragments replace it
+    m_FirstBlockData.reset();
+    m_FirstBlockStreams.clear();
+
+    if (!Fragment.empty())
+    {
+        m_CurrentFrame += Fragment[0].size();
+    }
+
+    // The parser would have started filling in the pending frames from the
+    // front, so the granules of the fragment go over them the same way
+    if (Pending.size() < Fragment.size())
+    {
+        Pending.resize(Fragment.size());
+    }
+    for (unsigned int i = 0; i < Fragment.size(); i++)
+    {
+        elStream& Str = Pending[i];
+        elStream& Frag = Fragment[i];
+        if (Str.empty())
+        {
+            Str.swap(Frag);
+            continue;
+        }
+        for (unsigned int j = 0; j < Frag.size(); j++)
+        {
+            if (j == Str.size())
+            {
+                Str.push_back().Swap(Frag[j]);
+                continue;
+            }
+            for (unsigned int k = 0; k < 2; k++)
+            {
+                if (Frag[j].Gr[k].Used)
+                {
+                    Str[j].Gr[k].Swap(Frag[j].Gr[k]);
+                }
+            }
+        }
+    }
+
+    TakeCompleteFrames(Pending, Parsed);
+    return;
+}
+
+void elMpegGenerator::TakeCompleteFrames(elStreamVector& Pending, elStreamVector& Parsed)
+{
+    // Hand over the frames up to the first one that can't be made into an MPEG frame yet
+    Parsed.resize(Pending.size());
+    for (unsigned int i = 0; i < Pending.size(); i++)
+    {
+        elStream& Str = Pending[i];
+
+        // Nothing can come before a leading half now, so it will never be complete
+        while (!Str.empty() && IsLeadingHalf(Str.front()))
+        {
+            VERBOSE("G: dropping the second granule of a frame that started before the first block");
+            Str.pop_front();
+        }
+
+        unsigned int Complete = 0;
+        while (Complete < Str.size() && IsFrameComplete(Str[Complete]))
+        {
+            Complete++;
+        }
+
+        Parsed[i].clear();
+        if (Complete == Str.size())
+        {
+            Parsed[i].swap(Str);
+        }
+        else
+        {
+            Parsed[i].resize(Complete);
+            for (unsigned int j = 0; j < Complete; j++)
+            {
+                Parsed[i][j].Swap(Str[j]);
+            }
+            Str.pop_front(Complete);
+        }
+    }
+    return;
+}
+
+void elMpegGenerator::AddParsedFrames(elStreamVector& Parsed, unsigned long SampleCount)
+{
+    // Sanity check
+    if (m_DoneParsingBlocks)
+    {
+        throw (elMpegGeneratorException("Already called DoneParsingBlocks(), can't parse any more blocks."));
+    }
+
+    m_SampleFrames += SampleCount;
 
     // Create a frame for each stream
     unsigned int OldCurMpegFrame = m_CurMpegFrame;
     for (unsigned int i = 0; i < m_StreamInfo.size(); i++)
     {
-        const elStream& CurStr = m_Streams[i];
+        elMpegStream& OutStr = m_Outputs[i];
 
         // The current frame index
         m_CurMpegFrame = OldCurMpegFrame;
 
-        while (CurStr.size())
+        for (unsigned int j = 0; i < Parsed.size() && j < Parsed[i].size(); j++)
         {
-            // Get the current and previous frames
-            m_Outputs[i].push_back(elMpegFrame());
-            elMpegFrame& CurOutFrame = m_Outputs[i][m_CurMpegFrame];
+            OutStr.Frames.push_back(elMpegFrame());
+            elMpegFrame& CurOutFrame = OutStr.Frames.back();
+            CurOutFrame.Offset = OutStr.Arena.Begin(MAX_MPEG_FRAME_BUFFER);
 
-            ConstructMpegFrame(CurStr[0], IS, CurOutFrame);
-            if (CurOutFrame.Used == 0)
-            {
-                m_Outputs[i].pop_back();
-                break;
-            }
-            else
-            {
-                m_CurMpegFrame++;
-                m_Streams[i].pop_front();
-            }
+            ConstructMpegFrame(Parsed[i][j], CurOutFrame, OutStr.Arena.Get(CurOutFrame.Offset));
+            assert(CurOutFrame.Used > 0);
+            OutStr.Arena.Commit(CurOutFrame.Offset, CurOutFrame.Used);
+            m_CurMpegFrame++;
+
+            m_StreamInfo[i].FramesParsed++;
+            m_StreamInfo[i].GranulesParsed += CurOutFrame.Version == MV_1 ? 2 : 1;
+        }
+
+        // Hand off everything but the look-ahead window, in batches. The window
+        // grows while its frames could still borrow from the ones before it.
+        if (m_Sink && OutStr.Frames.size() >= 2 * m_LookAhead)
+        {
+            CalculateFrameSizes(OutStr, m_StreamInfo[i].FramesWritten > 0);
+            WriteStreamedFrames(i, CountSettledFrames(OutStr, OutStr.Frames.size() - m_LookAhead));
         }
     }
     return;
@@ -219,48 +421,24 @@ void elMpegGenerator::DoneParsingBlocks()
     // Write the VBR frame again for each stream
     for (unsigned int i = 0; i < m_StreamInfo.size(); i++)
     {
-        // Get the total file size
-        unsigned long FileSize = 0;
-
-        // Go backwards through the frames and calculate their bitrates
-        for (unsigned int j = m_Outputs[i].size(); j > 0; j--)
+        if (m_Sink)
         {
-            elMpegFrame& Frame = m_Outputs[i][j - 1];
-
-            unsigned int FrameUsed;
-            unsigned int BitrateIndex;
-            FrameUsed = Frame.Used + Frame.UsedByNext;
-            BitrateIndex = EstimateBitrateIndex(FrameUsed, Frame.SampleRate, Frame.Version);
-
-            if (BitrateIndex > 0)
-            {
-                Frame.Size = CalculateFrameSize(BitrateIndex, Frame.SampleRate, Frame.Version);
-                Frame.UsedFromPrevious = 0;
-            }
-            else if (j > 1)
-            {
-                elMpegFrame& PrevFrame = m_Outputs[i][j - 2];
-
-                // Use the highest bitrate
-                BitrateIndex = 14;
-                Frame.Size = CalculateFrameSize(BitrateIndex, Frame.SampleRate, Frame.Version);
-
-                // Use some bytes from the previous frame
-                const unsigned int BytesNeed = FrameUsed - Frame.Size;
-                Frame.UsedFromPrevious = BytesNeed;
-                PrevFrame.UsedByNext = BytesNeed;
-            }
-            else
-            {
-                throw (elMpegGeneratorException("Was unable to construct MPEG audio frame. The bitrate exceeded the maximum."));
-            }
-
-            // Write
-            WriteFields(Frame, BitrateIndex, Frame.UsedFromPrevious);
-            FileSize += Frame.Size;
+            elStreamInfo& Info = m_StreamInfo[i];
+            CalculateFrameSizes(m_Outputs[i], Info.FramesWritten > 0);
+            WriteStreamedFrames(i, m_Outputs[i].Frames.size());
+
+            // Only the Xing fields change, and they are all before the main data
+            elMpegFrame& VbrFrame = m_VbrFrames[i];
+            uint8_t* Data = m_VbrFrameData[i].get();
+            ConstructMpegVbrFrame(NULL, VbrFrame, Data, Info.FramesWritten, Info.BytesWritten);
+            m_Sink->PatchVbrFrame(i, Data, VbrFrame.HeaderSize);
+        }
+        else
+        {
+            const unsigned long FileSize = CalculateFrameSizes(m_Outputs[i], false);
+            elMpegStream& Str = m_Outputs[i];
+            ConstructMpegVbrFrame(NULL, Str.Frames[0], Str.Arena.Get(Str.Frames[0].Offset), Str.Frames.size(), FileSize);
         }
-
-        ConstructMpegVbrFrame(NULL, m_Outputs[i][0], m_Outputs[i].size(), FileSize);
     }
 
     m_CurMpegFrame = 0;
@@ -276,6 +454,10 @@ shared_ptr<elMpegOutputStream> elMpegGenerator::CreateMpegStream(unsigned int St
     {
         throw (elMpegGeneratorException("Haven't called DoneParsingBlocks(), we're not done parsing blocks."));
     }
+    if (m_Sink)
+    {
+        throw (elMpegGeneratorException("The frames were already written out in streaming mode."));
+    }
     if (StreamIndex >= m_Outputs.size())
     {
         throw (elMpegGeneratorException("Stream index exceeds the number of streams."));
@@ -290,6 +472,10 @@ shared_ptr<elPcmOutputStream> elMpegGenerator::CreatePcmStream(unsigned int Stre
     {
         throw (elMpegGeneratorException("Haven't called DoneParsingBlocks(), we're not done parsing blocks."));
     }
+    if (m_Sink)
+    {
+        throw (elMpegGeneratorException("The frames were already written out in streaming mode."));
+    }
     if (StreamIndex >= m_Outputs.size())
     {
         throw (elMpegGeneratorException("Stream index exceeds the number of streams."));
@@ -304,11 +490,15 @@ unsigned int elMpegGenerator::GetFrameCount(unsigned int StreamIndex) const
     {
         throw (elMpegGeneratorException("Haven't called DoneParsingBlocks(), we're not done parsing blocks."));
     }
+    if (m_Sink)
+    {
+        throw (elMpegGeneratorException("The frames were already written out in streaming mode."));
+    }
     if (StreamIndex >= m_Outputs.size())
     {
         throw (elMpegGeneratorException("Stream index exceeds the number of streams."));
     }
-    return m_Outputs[StreamIndex].size();
+    return m_Outputs[StreamIndex].Frames.size();
 }
 
 
@@ -319,65 +509,53 @@ unsigned int elMpegGenerator::ReadFrame(uint8_t* Buffer, unsigned int BufferSize
     {
         throw (elMpegGeneratorException("Haven't called DoneParsingBlocks(), we're not done parsing blocks."));
     }
+    if (m_Sink)
+    {
+        throw (elMpegGeneratorException("The frames were already written out in streaming mode."));
+    }
     if (StreamIndex >= m_Outputs.size())
     {
         throw (elMpegGeneratorException("Stream index exceeds the number of streams."));
     }
-    if (!m_Outputs[StreamIndex].size())
+    if (!m_Outputs[StreamIndex].Frames.size())
     {
         throw (elMpegGeneratorException("No frames are outputted."));
     }
-    if (Index >= m_Outputs[StreamIndex].size())
+    if (Index >= m_Outputs[StreamIndex].Frames.size())
     {
         throw (elMpegGeneratorException("Current frame is past the end of the stream."));
     }
 
-    // The frame
-    const elMpegFrame& Frame = m_Outputs[StreamIndex][Index];
-    unsigned int ToCopy;
-    const uint8_t* OldBuffer = Buffer;
-
-    // Write the header
-    ToCopy = min(Frame.HeaderSize, BufferSize);
-
-    memcpy(Buffer, Frame.Data.get(), ToCopy);
-
-    BufferSize -= ToCopy;
-    Buffer += ToCopy;
-
-    // Write part of the main data
-    ToCopy = min(Frame.Used - Frame.HeaderSize - Frame.UsedFromPrevious, BufferSize);
-
-    memcpy(Buffer, Frame.Data.get() + Frame.HeaderSize + Frame.UsedFromPrevious, ToCopy);
-
-    BufferSize -= ToCopy;
-    Buffer += ToCopy;
-
-    // Write the padding
-    ToCopy = min(Frame.Size - (Frame.Used - Frame.UsedFromPrevious) - Frame.UsedByNext,
-                 BufferSize);
-
-    memset(Buffer, 0xE5, ToCopy);
-
-    BufferSize -= ToCopy;
-    Buffer += ToCopy;
+    return AssembleFrame(Buffer, BufferSize, m_Outputs[StreamIndex], Index);
+}
 
-    // Finally write any bytes used by the next frame
-    if (Frame.UsedByNext > 0)
+unsigned int elMpegGenerator::ReadFrames(uint8_t* Buffer, unsigned int BufferSize, unsigned int Index, unsigned int& Count, unsigned int StreamIndex) const
+{
+    // Check some things
+    if (!m_DoneParsingBlocks)
     {
-        const elMpegFrame& NextFrame = m_Outputs[StreamIndex][Index + 1];
-        assert(Frame.UsedByNext == NextFrame.UsedFromPrevious);
-
-        ToCopy = min(Frame.UsedByNext, BufferSize);
-
-        memcpy(Buffer, NextFrame.Data.get() + NextFrame.HeaderSize, ToCopy);
-
-        BufferSize -= ToCopy;
-        Buffer += ToCopy;
+        throw (elMpegGeneratorException("Haven't called DoneParsingBlocks(), we're not done parsing blocks."));
+    }
+    if (m_Sink)
+    {
+        throw (elMpegGeneratorException("The frames were already written out in streaming mode."));
+    }
+    if (StreamIndex >= m_Outputs.size())
+    {
+        throw (elMpegGeneratorException("Stream index exceeds the number of streams."));
     }
 
-    assert(Buffer - OldBuffer == Frame.Size);
-    return Frame.Size;
+    // Every frame is assembled to exactly its size, so they can be packed one after another
+    const elMpegStream& Str = m_Outputs[StreamIndex];
+    const unsigned int End = min((unsigned int)Str.Frames.size(), Index + Count);
+    unsigned int Bytes = 0;
+    Count = 0;
+    for (unsigned int i = Index; i < End && Str.Frames[i].Size <= BufferSize - Bytes; i++)
+    {
+        Bytes += AssembleFrame(Buffer + Bytes, BufferSize - Bytes, Str, i);
+        Count++;
+    }
+    return Bytes;
 }
 
 const elUncompressedSampleFrames& elMpegGenerator::ReadUncSamples(unsigned int Granule, unsigned int Index, unsigned int StreamIndex) const
@@ -387,30 +565,34 @@ const elUncompressedSampleFrames& elMpegGenerator::ReadUncSamples(unsigned int G
     {
         throw (elMpegGeneratorException("Haven't called DoneParsingBlocks(), we're not done parsing blocks."));
     }
+    if (m_Sink)
+    {
+        throw (elMpegGeneratorException("The frames were already written out in streaming mode."));
+    }
     if (StreamIndex >= m_Outputs.size())
     {
         throw (elMpegGeneratorException("Stream index exceeds the number of streams."));
     }
-    if (!m_Outputs[StreamIndex].size())
+    if (!m_Outputs[StreamIndex].Frames.size())
     {
         throw (elMpegGeneratorException("No frames are outputted."));
     }
-    if (Index >= m_Outputs[StreamIndex].size())
+    if (Index >= m_Outputs[StreamIndex].Frames.size())
     {
         throw (elMpegGeneratorException("Current frame is past the end of the stream."));
     }
 
     if (Granule == 1)
     {
-        return m_Outputs[StreamIndex][Index].UncompB;
+        return m_Outputs[StreamIndex].Frames[Index].UncompB;
     }
-    return m_Outputs[StreamIndex][Index].UncompA;
+    return m_Outputs[StreamIndex].Frames[Index].UncompA;
 }
 
 
-void elMpegGenerator::ReadBlockData(elStreamVector& Streams, bsBitstream& IS)
+void elMpegGenerator::ReadBlockData(elStreamVector& Streams, bsBitstream& IS, const elBlock& Block)
 {
-    m_Parser->Parse(Streams, IS);
+    m_Parser->Parse(Streams, IS, Block.Data);
     
 #ifdef ENABLE_VERY_VERBOSE
     if (g_Verbose >= 2)
@@ -423,10 +605,29 @@ void elMpegGenerator::ReadBlockData(elStreamVector& Streams, bsBitstream& IS)
     return;
 }
 
-void elMpegGenerator::ConstructMpegVbrFrame(const elGranule* Granule, elMpegFrame& Out, unsigned int Frames, unsigned int DataSize)
+bool elMpegGenerator::IsFrameComplete(const elFrame& Fr)
 {
-    bsBitstream OS(Out.Data.get(), MAX_MPEG_FRAME_BUFFER);
+    // The same checks that ConstructMpegFrame() makes
+    switch (Fr.Gr[0].Version)
+    {
+        case MV_1:
+            return Fr.Gr[0].Used && Fr.Gr[1].Used;
+        case MV_2:
+        case MV_2_5:
+            return Fr.Gr[0].Used;
+        default:
+            // Let ConstructMpegFrame() complain about it
+            return true;
+    }
+}
 
+bool elMpegGenerator::IsLeadingHalf(const elFrame& Fr)
+{
+    return !Fr.Gr[0].Used && Fr.Gr[1].Used && Fr.Gr[1].Version == MV_1;
+}
+
+void elMpegGenerator::ConstructMpegVbrFrame(const elGranule* Granule, elMpegFrame& Out, uint8_t* Data, unsigned int Frames, unsigned int DataSize)
+{
     // Get some stuff
     if (Granule)
     {
@@ -445,22 +646,26 @@ void elMpegGenerator::ConstructMpegVbrFrame(const elGranule* Granule, elMpegFram
     // Write the MPEG frame header if we have the information
     if (Granule)
     {
-        OS.WriteBits(0x7FF, 11);                // Frame sync
-        OS.WriteBits(Granule->Version, 2);      // Version
-        OS.WriteBits(0x1, 2);                   // Layer
-        OS.WriteBit(1);                         // CRC protection
-        OS.WriteBits(0, 4);                     // Bitrate index
-        OS.WriteBits(Granule->SampleRateIndex, 2); // Sample rate index
-        OS.WriteBit(0);                         // Padding
-        OS.WriteBit(0);                         // Private bit
-        OS.WriteBits(Granule->ChannelMode, 2);  // Channel mode
-        OS.WriteBits(Granule->ModeExtension, 2);// Channel mode extension
-        OS.WriteBit(1);                         // Copyrighted
-        OS.WriteBit(1);                         // Original
-        OS.WriteBits(0, 2);                     // Emphasis
+        bsBitWriter Header(Data, 4);
+
+        Header.WriteBits(0x7FF, 11);                // Frame sync
+        Header.WriteBits(Granule->Version, 2);      // Version
+        Header.WriteBits(0x1, 2);                   // Layer
+        Header.WriteBit(1);                         // CRC protection
+        Header.WriteBits(0, 4);                     // Bitrate index
+        Header.WriteBits(Granule->SampleRateIndex, 2); // Sample rate index
+        Header.WriteBit(0);                         // Padding
+        Header.WriteBit(0);                         // Private bit
+        Header.WriteBits(Granule->ChannelMode, 2);  // Channel mode
+        Header.WriteBits(Granule->ModeExtension, 2);// Channel mode extension
+        Header.WriteBit(1);                         // Copyrighted
+        Header.WriteBit(1);                         // Original
+        Header.WriteBits(0, 2);                     // Emphasis
+        Header.Flush();
     }
 
     // Write the side info (zeros)
+    bsBitstream OS(Data, MAX_MPEG_FRAME_BUFFER);
     OS.SeekAbsolute(32);
     for (unsigned int i = 0; i < SideInfoSize; i++)
     {
@@ -472,23 +677,26 @@ void elMpegGenerator::ConstructMpegVbrFrame(const elGranule* Granule, elMpegFram
     OS.WriteAligned8<char>('i');
     OS.WriteAligned8<char>('n');
     OS.WriteAligned8<char>('g');
-    OS.WriteAligned32BE<uint32_t>(VBR_FRAMES_FLAG | VBR_BYTES_FLAG);
+    // The placeholder from before the frames are counted doesn't claim any counts, since
+    // it stays as it is when it was streamed to an output that can't be patched. The
+    // fields are still there so that it's the same size as the real one.
+    OS.WriteAligned32BE<uint32_t>(Frames ? VBR_FRAMES_FLAG | VBR_BYTES_FLAG : 0);
     OS.WriteAligned32BE<uint32_t>(Frames);
     OS.WriteAligned32BE<uint32_t>(DataSize);
     return;
 }
 
 
-void elMpegGenerator::ConstructMpegFrame(const elFrame& Fr, bsBitstream& IS, elMpegGenerator::elMpegFrame& Out)
+void elMpegGenerator::ConstructMpegFrame(elFrame& Fr, elMpegGenerator::elMpegFrame& Out, uint8_t* Data)
 {
     switch (Fr.Gr[0].Version)
     {
         case MV_1:
-            ConstructMpegFrameV1(Fr, IS, Out);
+            ConstructMpegFrameV1(Fr, Out, Data);
         break;
         case MV_2:
         case MV_2_5:
-            ConstructMpegFrameV2(Fr, IS, Out);
+            ConstructMpegFrameV2(Fr, Out, Data);
         break;
         default:
             throw (elMpegGeneratorException("Invalid version passed to ConstructMpegFrame."));
@@ -496,7 +704,7 @@ void elMpegGenerator::ConstructMpegFrame(const elFrame& Fr, bsBitstream& IS, elM
     return;
 }
 
-void elMpegGenerator::ConstructMpegFrameV1(const elFrame& Fr, bsBitstream& IS, elMpegFrame& Out)
+void elMpegGenerator::ConstructMpegFrameV1(elFrame& Fr, elMpegFrame& Out, uint8_t* Data)
 {
     const elGranule& BaseGr = Fr.Gr[0];
 
@@ -535,11 +743,12 @@ void elMpegGenerator::ConstructMpegFrameV1(const elFrame& Fr, bsBitstream& IS, e
 
     Out.Used += DataBitCount / 8;
 
-    Out.UncompA = Fr.Gr[0].Uncomp;
-    Out.UncompB = Fr.Gr[1].Uncomp;
+    // The parsed frame isn't needed after this, so take its samples
+    Out.UncompA.Swap(Fr.Gr[0].Uncomp);
+    Out.UncompB.Swap(Fr.Gr[1].Uncomp);
 
     // Write the MPEG header
-    bsBitstream OS(Out.Data.get(), MAX_MPEG_FRAME_BUFFER);
+    bsBitWriter OS(Data, MAX_MPEG_FRAME_BUFFER);
     unsigned int Padding = 0;
 
     OS.WriteBits(0x7FF, 11);                    // Frame sync
@@ -556,8 +765,8 @@ void elMpegGenerator::ConstructMpegFrameV1(const elFrame& Fr, bsBitstream& IS, e
     OS.WriteBit(1);                             // Original
     OS.WriteBits(0, 2);                         // Emphasis
 
-    m_UncompressedSampleFrames += Fr.Gr[0].Uncomp.Count;
-    m_UncompressedSampleFrames += Fr.Gr[1].Uncomp.Count;
+    m_UncompressedSampleFrames += Out.UncompA.Count;
+    m_UncompressedSampleFrames += Out.UncompB.Count;
 
     Out.Version = BaseGr.Version;
     Out.SampleRate = BaseGr.SampleRate;
@@ -591,29 +800,16 @@ void elMpegGenerator::ConstructMpegFrameV1(const elFrame& Fr, bsBitstream& IS, e
         {
             continue;
         }
-        
-        bsBitstream DataReader(Fr.Gr[i].Data.get(), Fr.Gr[i].DataSize);
-
-        for (unsigned int j = 0; j < BaseGr.Channels; j++)
-        {
-            unsigned int BitsLeft = Fr.Gr[i].ChannelInfo[j].Size;
-
-            while (BitsLeft)
-            {
-                unsigned int BitsToRead = min(32, BitsLeft);
-                uint32_t Bits = DataReader.ReadBits(BitsToRead);
-                OS.WriteBits(Bits, BitsToRead);
-                BitsLeft -= BitsToRead;
-            }
-        }
+        OS.CopyBits(Fr.Gr[i].Data.get(), Fr.Gr[i].DataOffset, Fr.Gr[i].DataSizeBits);
     }
 
     // Pad to the nearest byte
     OS.WriteToNextByte();
+    OS.Flush();
     return;
 }
 
-void elMpegGenerator::ConstructMpegFrameV2(const elFrame& Fr, bsBitstream& IS, elMpegFrame& Out)
+void elMpegGenerator::ConstructMpegFrameV2(const elFrame& Fr, elMpegFrame& Out, uint8_t* Data)
 {
     const elGranule& BaseGr = Fr.Gr[0];
 
@@ -651,7 +847,7 @@ void elMpegGenerator::ConstructMpegFrameV2(const elFrame& Fr, bsBitstream& IS, e
     Out.Used += DataBitCount / 8;
 
     // Write the MPEG header
-    bsBitstream OS(Out.Data.get(), MAX_MPEG_FRAME_BUFFER);
+    bsBitWriter OS(Data, MAX_MPEG_FRAME_BUFFER);
     unsigned int Padding = 0;
 
     OS.WriteBits(0x7FF, 11);                    // Frame sync
@@ -689,24 +885,12 @@ void elMpegGenerator::ConstructMpegFrameV2(const elFrame& Fr, bsBitstream& IS, e
     // Now write the actual data
     if (BaseGr.DataSize > 0)
     {
-        bsBitstream DataReader(BaseGr.Data.get(), BaseGr.DataSize);
-
-        for (unsigned int j = 0; j < BaseGr.Channels; j++)
-        {
-            unsigned int BitsLeft = BaseGr.ChannelInfo[j].Size;
-
-            while (BitsLeft)
-            {
-                unsigned int BitsToRead = min(32, BitsLeft);
-                uint32_t Bits = DataReader.ReadBits(BitsToRead);
-                OS.WriteBits(Bits, BitsToRead);
-                BitsLeft -= BitsToRead;
-            }
-        }
+        OS.CopyBits(BaseGr.Data.get(), BaseGr.DataOffset, BaseGr.DataSizeBits);
     }
 
     // Pad to the nearest byte
     OS.WriteToNextByte();
+    OS.Flush();
     return;
 }
 
@@ -782,9 +966,9 @@ unsigned int elMpegGenerator::CalculateMainDataStartBits(unsigned int Version)
     return 0;
 }
 
-void elMpegGenerator::WriteFields(elMpegFrame& Frame, unsigned int NewBitrateIndex, unsigned int NewUsedFromPrev) const
+void elMpegGenerator::WriteFields(elMpegFrame& Frame, uint8_t* Data, unsigned int NewBitrateIndex, unsigned int NewUsedFromPrev) const
 {
-    bsBitstream OS(Frame.Data.get(), 8);
+    bsBitstream OS(Data, 8);
     OS.SeekAbsolute(16);
     OS.WriteBits(NewBitrateIndex, 4);
     OS.SeekAbsolute(32);
@@ -792,6 +976,167 @@ void elMpegGenerator::WriteFields(elMpegFrame& Frame, unsigned int NewBitrateInd
     return;
 }
 
+unsigned long elMpegGenerator::CalculateFrameSizes(elMpegStream& Str, bool HasWrittenFrames) const
+{
+    std::vector<elMpegFrame>& Frames = Str.Frames;
+
+    // Bytes of the first frame that already went out at the end of the frame before it
+    const unsigned int Committed = Frames.size() ? Frames[0].UsedFromPrevious : 0;
+
+    // Get the total size
+    unsigned long FileSize = 0;
+
+    // Go backwards through the frames and calculate their bitrates
+    for (unsigned int j = Frames.size(); j > 0; j--)
+    {
+        elMpegFrame& Frame = Frames[j - 1];
+
+        unsigned int FrameUsed;
+        unsigned int BitrateIndex;
+        FrameUsed = Frame.Used + Frame.UsedByNext;
+        BitrateIndex = EstimateBitrateIndex(FrameUsed, Frame.SampleRate, Frame.Version);
+
+        if (BitrateIndex > 0)
+        {
+            Frame.Size = CalculateFrameSize(BitrateIndex, Frame.SampleRate, Frame.Version);
+            Frame.UsedFromPrevious = 0;
+            if (j > 1)
+            {
+                Frames[j - 2].UsedByNext = 0;
+            }
+            else if (HasWrittenFrames && Committed)
+            {
+                throw (elMpegGeneratorException("Was unable to construct MPEG audio frame. The streaming look-ahead was too short."));
+            }
+        }
+        else if (j > 1 || HasWrittenFrames)
+        {
+            // Use the highest bitrate
+            BitrateIndex = 14;
+            Frame.Size = CalculateFrameSize(BitrateIndex, Frame.SampleRate, Frame.Version);
+
+            // Use some bytes from the previous frame
+            const unsigned int BytesNeed = FrameUsed - Frame.Size;
+            Frame.UsedFromPrevious = BytesNeed;
+            if (j > 1)
+            {
+                Frames[j - 2].UsedByNext = BytesNeed;
+            }
+            else if (BytesNeed != Committed)
+            {
+                throw (elMpegGeneratorException("Was unable to construct MPEG audio frame. The streaming look-ahead was too short."));
+            }
+        }
+        else
+        {
+            throw (elMpegGeneratorException("Was unable to construct MPEG audio frame. The bitrate exceeded the maximum."));
+        }
+
+        // Write
+        WriteFields(Frame, Str.Arena.Get(Frame.Offset), BitrateIndex, Frame.UsedFromPrevious);
+        FileSize += Frame.Size;
+    }
+    return FileSize;
+}
+
+unsigned int elMpegGenerator::AssembleFrame(uint8_t* Buffer, unsigned int BufferSize, const elMpegStream& Str, unsigned int Index) const
+{
+    const elMpegFrame& Frame = Str.Frames[Index];
+    const uint8_t* Data = Str.Arena.Get(Frame.Offset);
+    unsigned int ToCopy;
+    const uint8_t* OldBuffer = Buffer;
+
+    // Write the header
+    ToCopy = min(Frame.HeaderSize, BufferSize);
+
+    memcpy(Buffer, Data, ToCopy);
+
+    BufferSize -= ToCopy;
+    Buffer += ToCopy;
+
+    // Write part of the main data
+    ToCopy = min(Frame.Used - Frame.HeaderSize - Frame.UsedFromPrevious, BufferSize);
+
+    memcpy(Buffer, Data + Frame.HeaderSize + Frame.UsedFromPrevious, ToCopy);
+
+    BufferSize -= ToCopy;
+    Buffer += ToCopy;
+
+    // Write the padding
+    ToCopy = min(Frame.Size - (Frame.Used - Frame.UsedFromPrevious) - Frame.UsedByNext,
+                 BufferSize);
+
+    memset(Buffer, 0xE5, ToCopy);
+
+    BufferSize -= ToCopy;
+    Buffer += ToCopy;
+
+    // Finally write any bytes used by the next frame
+    if (Frame.UsedByNext > 0)
+    {
+        assert(Index + 1 < Str.Frames.size());
+        const elMpegFrame& NextFrame = Str.Frames[Index + 1];
+        assert(Frame.UsedByNext == NextFrame.UsedFromPrevious);
+
+        ToCopy = min(Frame.UsedByNext, BufferSize);
+
+        memcpy(Buffer, Str.Arena.Get(NextFrame.Offset) + NextFrame.HeaderSize, ToCopy);
+
+        BufferSize -= ToCopy;
+        Buffer += ToCopy;
+    }
+
+    assert(Buffer - OldBuffer == Frame.Size);
+    return Frame.Size;
+}
+
+unsigned int elMpegGenerator::CountSettledFrames(const elMpegStream& Str, unsigned int Limit) const
+{
+    // Nothing that comes later can change the frames before one that would fit
+    // at the highest bitrate even if the frame after it borrowed all it can
+    for (unsigned int j = min(Limit, (unsigned int)Str.Frames.size() - 1); j > 0; j--)
+    {
+        const elMpegFrame& Frame = Str.Frames[j];
+        const unsigned int MaxBorrowed = (1 << CalculateMainDataStartBits(Frame.Version)) - 1;
+        if (Frame.Used + MaxBorrowed <= CalculateFrameSize(14, Frame.SampleRate, Frame.Version))
+        {
+            return j;
+        }
+    }
+    return 0;
+}
+
+void elMpegGenerator::WriteStreamedFrames(unsigned int StreamIndex, unsigned int Count)
+{
+    elMpegStream& Str = m_Outputs[StreamIndex];
+    elStreamInfo& Info = m_StreamInfo[StreamIndex];
+    uint8_t Buffer[MAX_MPEG_FRAME_BUFFER];
+
+    assert(Count <= Str.Frames.size());
+    for (unsigned int j = 0; j < Count; j++)
+    {
+        const unsigned int Size = AssembleFrame(Buffer, sizeof(Buffer), Str, j);
+
+        // Keep the VBR info frame so that it can be patched later
+        if (Info.FramesWritten == 0)
+        {
+            const elMpegFrame& VbrFrame = Str.Frames[j];
+            m_VbrFrames[StreamIndex] = VbrFrame;
+            m_VbrFrameData[StreamIndex] = shared_array<uint8_t>(new uint8_t[VbrFrame.HeaderSize]);
+            memcpy(m_VbrFrameData[StreamIndex].get(), Str.Arena.Get(VbrFrame.Offset), VbrFrame.HeaderSize);
+        }
+
+        m_Sink->WriteFrame(StreamIndex, Buffer, Size);
+        Info.FramesWritten++;
+        Info.BytesWritten += Size;
+    }
+    Str.Frames.erase(Str.Frames.begin(), Str.Frames.begin() + Count);
+
+    // Let go of the bytes of the frames that were written
+    Str.Arena.Discard(Str.Frames.size() ? Str.Frames[0].Offset : Str.Arena.GetEnd());
+    return;
+}
+
 // Helper functions
 
 void elMpegGenerator::Print(const elGranule& Gr, const std::string& Indent)
@@ -843,22 +1188,19 @@ void elMpegGenerator::Print(const elStreamVector& Streams)
     {
         std::cout << "Stream #" << I1 << ": " << std::endl;
 
-        unsigned int I2 = 0;
-        for (elStream::const_iterator Iter2 = Iter1->begin();
-                Iter2 != Iter1->end(); ++Iter2)
+        for (unsigned int I2 = 0; I2 < Iter1->size(); I2++)
         {
             std::cout << "    Frame #" << I2 << " (" << I2 + m_CurrentFrame << "): " << std::endl;
 
             for (unsigned int i = 0; i < 2; i++)
             {
-                const elGranule& Gr = Iter2->Gr[i];
+                const elGranule& Gr = (*Iter1)[I2].Gr[i];
 
                 std::cout << "        Granule #" << i << ": " << std::endl;
                 Print(Gr, "            ");
             }
 
             std::cout << std::endl;
-            I2++;
         }
 
         std::cout << std::endl;
@@ -8,6 +8,7 @@
 
 #include "Internal.h"
 #include "Parser.h"
+#include "FrameArena.h"
 
 #define MAX_MPEG_FRAME_BUFFER (144 * 1000 * 320 / 32000 * 2)
 
@@ -16,6 +17,19 @@ class elBlock;
 class elMpegOutputStream;
 class elPcmOutputStream;
 
+/// Receives finished MPEG frames from a generator in streaming mode.
+class elMpegFrameSink
+{
+public:
+    virtual ~elMpegFrameSink();
+
+    /// Called with each finished frame of a stream, in order. Frame 0 is the VBR info frame.
+    virtual void WriteFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size) = 0;
+
+    /// Called from DoneParsingBlocks() with the completed VBR info frame, which has the same size as frame 0.
+    virtual void PatchVbrFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size) = 0;
+};
+
 class elMpegGenerator
 {
 public:
@@ -43,9 +57,44 @@ public:
     /// Get the number of channels in a stream.
     unsigned int GetChannels(unsigned int StreamIndex = 0) const;
 
+    /// Get how many MP3 frames (not counting the VBR info frame) and granules have been made for a stream so far.
+    unsigned int GetParsedFrameCount(unsigned int StreamIndex = 0) const;
+    unsigned int GetParsedGranuleCount(unsigned int StreamIndex = 0) const;
+
+    /**
+     * Emit frames to Sink as soon as they are finished instead of keeping the whole stream.
+     * At least LookAhead frames per stream are held back for the bitrate calculation, and
+     * more while a frame could still borrow from the ones before it, so the memory use
+     * doesn't grow with the length of the input. Call after Initialize().
+     * The output streams can't be created in this mode.
+     */
+    void SetStreaming(elMpegFrameSink* Sink, unsigned int LookAhead = 32);
+
     /// Parses the block and adds it to the internal output buffer. Remember to call this on the first frame.
     void ParseBlock(const elBlock& Block);
 
+    /**
+     * The two halves of ParseBlock(), so that they can run on different threads.
+     * ParseBlockFrames() only uses the parser. It parses the block into Pending, which
+     * holds on to the frames that aren't complete yet, and replaces Parsed with the
+     * frames that are. AddParsedFrames() then turns those into MPEG frames, taking
+     * the uncompressed samples out of Parsed.
+     */
+    void ParseBlockFrames(const elBlock& Block, elStreamVector& Pending, elStreamVector& Parsed);
+    void AddParsedFrames(elStreamVector& Parsed, unsigned long SampleCount);
+
+    /**
+     * ParseBlockFrames() split again, so that many blocks can be parsed at once.
+     * ParseBlockFragment() parses a block on its own into Fragment using a parser
+     * from CloneParser(), one per thread, and doesn't change the generator.
+     * MergeBlockFragment() then has to be given the fragments in block order. It
+     * adds them to Pending and replaces Parsed like ParseBlockFrames(). A fragment
+     * that starts in the middle of a frame is joined to the frame left in Pending.
+     */
+    shared_ptr<elParser> CloneParser() const;
+    void ParseBlockFragment(elParser& Parser, const elBlock& Block, elStreamVector& Fragment) const;
+    void MergeBlockFragment(elStreamVector& Fragment, elStreamVector& Pending, elStreamVector& Parsed);
+
     /// Call this when all the blocks have been read in.
     void DoneParsingBlocks();
 
@@ -61,6 +110,10 @@ public:
     /// Reads a frame from the output.
     unsigned int ReadFrame(uint8_t* Buffer, unsigned int BufferSize, unsigned int Index, unsigned int StreamIndex = 0) const;
 
+    /// Reads up to Count whole frames starting at Index, as many as fit in the buffer, and sets
+    /// Count to how many were read. Returns the number of bytes.
+    unsigned int ReadFrames(uint8_t* Buffer, unsigned int BufferSize, unsigned int Index, unsigned int& Count, unsigned int StreamIndex = 0) const;
+
     /// Gets uncompressed samples from the output.
     const elUncompressedSampleFrames& ReadUncSamples(unsigned int Granule, unsigned int Index, unsigned int StreamIndex = 0) const;
 
@@ -69,19 +122,30 @@ protected:
     /// Information about each stream.
     struct elStreamInfo
     {
+        elStreamInfo() : SampleRate(0), Channels(0), FramesParsed(0),
+            GranulesParsed(0), FramesWritten(0), BytesWritten(0) {};
+
         unsigned int SampleRate;
         unsigned char Channels;
+
+        /// The frames and granules that have gone into the output.
+        unsigned int FramesParsed;
+        unsigned int GranulesParsed;
+
+        /// The frames that have been handed to the sink in streaming mode.
+        unsigned int FramesWritten;
+        unsigned long BytesWritten;
     };
 
-    /// A place to store a decoded MPEG audio frame.
+    /// A place to store a decoded MPEG audio frame. The bytes are in the stream's arena.
     struct elMpegFrame
     {
-        elMpegFrame() : HeaderSize(0), Data(new uint8_t[MAX_MPEG_FRAME_BUFFER]),
+        elMpegFrame() : HeaderSize(0), Offset(0),
             Used(0), Size(0), UsedFromPrevious(0), UsedByNext(0), Version(0),
             SampleRate(0), Channels(0) {};
 
         unsigned int HeaderSize;
-        shared_array<uint8_t> Data;
+        unsigned long Offset;
         unsigned int Used;
         unsigned int Size;
         unsigned int UsedFromPrevious;
@@ -95,15 +159,25 @@ protected:
         elUncompressedSampleFrames UncompB;
     };
 
+    /// The MPEG audio frames of a stream and the arena holding their bytes.
+    struct elMpegStream
+    {
+        std::vector<elMpegFrame> Frames;
+        elFrameArena Arena;
+    };
+
     typedef std::vector<elStreamInfo> elStreamInfoVector;
-    typedef std::vector<elMpegFrame> elMpegStream;
     typedef std::vector<elMpegStream> elMpegStreamVector;
 
-    void ReadBlockData(elStreamVector& Streams, bsBitstream& IS);
-    void ConstructMpegVbrFrame(const elGranule* Granule, elMpegFrame& Out, unsigned int Frames, unsigned int DataSize);
-    void ConstructMpegFrame(const elFrame& Fr, bsBitstream& IS, elMpegFrame& Out);
-    void ConstructMpegFrameV1(const elFrame& Fr, bsBitstream& IS, elMpegFrame& Out);
-    void ConstructMpegFrameV2(const elFrame& Fr, bsBitstream& IS, elMpegFrame& Out);
+    void ReadBlockData(elStreamVector& Streams, bsBitstream& IS, const elBlock& Block);
+    static bool IsFrameComplete(const elFrame& Fr);
+    /// The frame only has the second granule of an MPEG-1 frame, which a block started with.
+    static bool IsLeadingHalf(const elFrame& Fr);
+    static void TakeCompleteFrames(elStreamVector& Pending, elStreamVector& Parsed);
+    void ConstructMpegVbrFrame(const elGranule* Granule, elMpegFrame& Out, uint8_t* Data, unsigned int Frames, unsigned int DataSize);
+    void ConstructMpegFrame(elFrame& Fr, elMpegFrame& Out, uint8_t* Data);
+    void ConstructMpegFrameV1(elFrame& Fr, elMpegFrame& Out, uint8_t* Data);
+    void ConstructMpegFrameV2(const elFrame& Fr, elMpegFrame& Out, uint8_t* Data);
 public:
     static unsigned int EstimateBitrateIndex(unsigned int FrameUsed, unsigned int SampleRate, unsigned int Version);
     static unsigned int CalculateFrameSize(unsigned int BitrateIndex, unsigned int SampleRate, unsigned int Version);
@@ -111,7 +185,12 @@ public:
     static unsigned int CalculatePrivateBits(unsigned int Channels, unsigned int Version);
     static unsigned int CalculateMainDataStartBits(unsigned int Version);
 protected:
-    void WriteFields(elMpegFrame& Frame, unsigned int NewBitrateIndex, unsigned int NewUsedFromPrev) const;
+    void WriteFields(elMpegFrame& Frame, uint8_t* Data, unsigned int NewBitrateIndex, unsigned int NewUsedFromPrev) const;
+    unsigned long CalculateFrameSizes(elMpegStream& Str, bool HasWrittenFrames) const;
+    unsigned int AssembleFrame(uint8_t* Buffer, unsigned int BufferSize, const elMpegStream& Str, unsigned int Index) const;
+    /// Get how many frames from the front, up to Limit, the frames after them can't change any more.
+    unsigned int CountSettledFrames(const elMpegStream& Str, unsigned int Limit) const;
+    void WriteStreamedFrames(unsigned int StreamIndex, unsigned int Count);
 
     void Print(const elGranule& Gr, const std::string& Indent);
     void Print(const elStreamVector& Streams);
@@ -122,6 +201,13 @@ protected:
     /// The data read from the file.
     elStreamVector m_Streams;
 
+    /// The complete frames of the last block from ParseBlock(), kept so that their slots are reused.
+    elStreamVector m_ParsedStreams;
+
+    /// The first block as parsed by Initialize(), kept so that it isn't parsed again.
+    shared_array<uint8_t> m_FirstBlockData;
+    elStreamVector m_FirstBlockStreams;
+
     /// The current frame number for debugging purposes.
     unsigned long m_CurrentFrame;
 
@@ -145,6 +231,16 @@ protected:
 
     /// Hold all of the outputted MPEG audio frames for each stream.
     elMpegStreamVector m_Outputs;
+
+    /// Where the frames go in streaming mode, or NULL.
+    elMpegFrameSink* m_Sink;
+
+    /// How many frames of each stream are held back in streaming mode.
+    unsigned int m_LookAhead;
+
+    /// The VBR info frame of each stream, kept for patching in streaming mode.
+    std::vector<elMpegFrame> m_VbrFrames;
+    std::vector< shared_array<uint8_t> > m_VbrFrameData;
 };
 
 class elMpegGeneratorException : public std::exception
@@ -223,12 +223,9 @@ bool elMpegParser::ProcessMpegFrame(elFrame& Fr, elMpegParser::elRawFrameHeader&
 
     for (unsigned int i = 0; i < 2; i++)
     {
-        Fr.Gr[i].ChannelInfo.clear();
-        
         for (unsigned int j = 0; j < Hdr.Channels; j++)
         {
-            Fr.Gr[i].ChannelInfo.push_back(elChannelInfo());
-            Fr.Gr[i].ChannelInfo.back().Scfsi = 0;
+            Fr.Gr[i].ChannelInfo[j] = elChannelInfo();
         }
     }
     
@@ -244,15 +241,21 @@ bool elMpegParser::ProcessMpegFrame(elFrame& Fr, elMpegParser::elRawFrameHeader&
     // Parse the side info.
     const unsigned int GrCount = Hdr.Version == MV_1 ? 2 : 1;
     unsigned int MainDataStart;
-    
-    MainDataStart = IS.ReadBits(elMpegGenerator::CalculateMainDataStartBits(Hdr.Version));
-    IS.ReadBits(elMpegGenerator::CalculatePrivateBits(Hdr.Channels, Hdr.Version));
+    bsBitReader Reader(IS);
+
+    if (Reader.GetCountBitsLeft() < SideInfoSize * 8)
+    {
+        throw (elMpegParserException("The frame is too small to hold its side info."));
+    }
+
+    MainDataStart = Reader.ReadBits(elMpegGenerator::CalculateMainDataStartBits(Hdr.Version));
+    Reader.SkipBits(elMpegGenerator::CalculatePrivateBits(Hdr.Channels, Hdr.Version));
 
     if (Hdr.Version == MV_1)
     {
         for (unsigned int i = 0; i < Hdr.Channels; i++)
         {
-            Fr.Gr[1].ChannelInfo[i].Scfsi = IS.ReadBits(4);
+            Fr.Gr[1].ChannelInfo[i].Scfsi = Reader.ReadBits(4);
         }
     }
 
@@ -264,21 +267,22 @@ bool elMpegParser::ProcessMpegFrame(elFrame& Fr, elMpegParser::elRawFrameHeader&
             elGranule& Gr = Fr.Gr[i];
             elChannelInfo& Ci = Gr.ChannelInfo[j];
             
-            Ci.Size = IS.ReadBits(12);
+            Ci.Size = Reader.ReadBits(12);
             //VERBOSE("        Size: " << Ci.Size);
-            Ci.SideInfo[0] = IS.ReadBits(32);
+            Ci.SideInfo[0] = Reader.ReadBits(32);
             if (Gr.Version == MV_1)
             {
-                Ci.SideInfo[1] = IS.ReadBits(47 - 32);
+                Ci.SideInfo[1] = Reader.ReadBits(47 - 32);
             }
             else
             {
-                Ci.SideInfo[1] = IS.ReadBits(51 - 32);
+                Ci.SideInfo[1] = Reader.ReadBits(51 - 32);
             }
 
             DataSize += Ci.Size;
         }
     }
+    IS.SeekAbsolute(Reader.Tell());
 
     // Convert DataSize to bytes.
     if (DataSize % 8)
@@ -327,27 +331,29 @@ bool elMpegParser::ProcessMpegFrame(elFrame& Fr, elMpegParser::elRawFrameHeader&
         if (GrDataSize)
         {
             Gr.Data = shared_array<uint8_t>(new uint8_t[Gr.DataSize]);
+            Gr.DataOffset = 0;
 
-            bsBitstream OS(Gr.Data.get(), Gr.DataSize);
-            while (GrDataSize)
+            // The data starts in the reservoir and carries on in this frame
+            bsBitWriter OS(Gr.Data.get(), Gr.DataSize);
+            if (ResBitsLeft > 0)
             {
-                if (ResBitsLeft > 0)
-                {
-                    unsigned int BitsToRead = min(min(32, ResBitsLeft), GrDataSize);
-                    uint32_t Bits = Res.ReadBits(BitsToRead);
-                    OS.WriteBits(Bits, BitsToRead);
-                    ResBitsLeft -= BitsToRead;
-                    GrDataSize -= BitsToRead;
-                }
-                else
+                const unsigned int BitsToRead = min(ResBitsLeft, GrDataSize);
+                OS.CopyBits(Res.GetData(), Res.Tell(), BitsToRead);
+                Res.SeekRelative(BitsToRead);
+                ResBitsLeft -= BitsToRead;
+                GrDataSize -= BitsToRead;
+            }
+            if (GrDataSize > 0)
+            {
+                if (GrDataSize > IS.GetCountBitsLeft())
                 {
-                    unsigned int BitsToRead = min(32, GrDataSize);
-                    uint32_t Bits = IS.ReadBits(BitsToRead);
-                    OS.WriteBits(Bits, BitsToRead);
-                    GrDataSize -= BitsToRead;
+                    throw (elMpegParserException("Main data goes beyond the end of the frame."));
                 }
+                OS.CopyBits(IS.GetData(), IS.Tell(), GrDataSize);
+                IS.SeekRelative(GrDataSize);
             }
             OS.WriteToNextByte();
+            OS.Flush();
         }
         else
         {
@@ -14,6 +14,8 @@ typedef unsigned int uint32_t;
 typedef char int8_t;
 typedef short int16_t;
 typedef int int32_t;
+typedef unsigned __int64 uint64_t;
+typedef __int64 int64_t;
 typedef long ssize_t;
 
 #else
@@ -15,6 +15,28 @@ static const unsigned int MpegSampleRateTable[4][4] = {
     {44100, 48000, 32000, 0}
 };
 
+void elGranule::Swap(elGranule& Other)
+{
+    std::swap(Used, Other.Used);
+    std::swap(Version, Other.Version);
+    std::swap(SampleRateIndex, Other.SampleRateIndex);
+    std::swap(SampleRate, Other.SampleRate);
+    std::swap(ChannelMode, Other.ChannelMode);
+    std::swap(Channels, Other.Channels);
+    std::swap(ModeExtension, Other.ModeExtension);
+    std::swap(Index, Other.Index);
+    Data.swap(Other.Data);
+    std::swap(DataOffset, Other.DataOffset);
+    std::swap(DataSize, Other.DataSize);
+    std::swap(DataSizeBits, Other.DataSizeBits);
+    Uncomp.Swap(Other.Uncomp);
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        std::swap(ChannelInfo[i], Other.ChannelInfo[i]);
+    }
+    return;
+}
+
 elParser::elParser() :
     m_CurrentFrame(0)
 {
@@ -31,32 +53,49 @@ const std::string elParser::GetName() const
     return "EAL3 ver. 5";
 }
 
+shared_ptr<elParser> elParser::Clone() const
+{
+    return make_shared<elParser>(*this);
+}
+
 bool elParser::Initialize(bsBitstream& IS)
 {
-    bool First = true;
+    return Probe(IS) > 0;
+}
+
+unsigned int elParser::Probe(bsBitstream& IS, unsigned int MaxGranules)
+{
+    unsigned int Granules = 0;
     try
     {
-        while (!IS.Eos())
+        while (Granules < MaxGranules && !IS.Eos())
         {
             elGranule Gr;
             if (!ReadGranuleWithUncSamples(IS, Gr))
             {
-                if (First)
-                {
-                    throw (elParserException("There aren't any granules."));
-                }
                 break;
             }
-            First = false;
+            Granules++;
         }
     }
     catch (elParserException& E)
     {
         VERBOSE("P: " << GetName() << " incorrect with exception: " << E.what());
-        return false;
+        return 0;
     }
-    VERBOSE("P: " << GetName() << " correct");
-    return true;
+
+    if (!Granules)
+    {
+        VERBOSE("P: " << GetName() << " incorrect, there aren't any granules");
+        return 0;
+    }
+    VERBOSE("P: " << GetName() << " read " << Granules << " granules");
+    return Granules;
+}
+
+bool elParser::UseRunnerUp()
+{
+    return false;
 }
 
 inline void PutStreamOnBack(elStreamVector& Streams, unsigned int CurrentStream)
@@ -76,7 +115,7 @@ inline void PutFrameOnBack(elStream& Frames, unsigned int CurrentFrame)
 {
     if (CurrentFrame == Frames.size())
     {
-        Frames.push_back(elFrame());
+        Frames.push_back();
     }
     else if (CurrentFrame > Frames.size())
     {
@@ -85,8 +124,11 @@ inline void PutFrameOnBack(elStream& Frames, unsigned int CurrentFrame)
     return;
 }
 
-void elParser::Parse(elStreamVector& Streams, bsBitstream& IS)
+void elParser::Parse(elStreamVector& Streams, bsBitstream& IS, const shared_array<uint8_t>& BlockData)
 {
+    assert(IS.GetData() == BlockData.get());
+    m_BlockData = BlockData;
+
     unsigned int CurrentStream = 0;
     unsigned int CurrentGranule = 0;
     unsigned int CurrentFrame = 0;
@@ -112,29 +154,31 @@ void elParser::Parse(elStreamVector& Streams, bsBitstream& IS)
                 CurrentFrame++;
                 for (elStreamVector::iterator Str = Streams.begin(); Str != Streams.end(); ++Str)
                 {
-                    Str->push_back(elFrame());
+                    Str->push_back();
                 }
             }
-
-            // Set the granule only if it's used
-            if (Gr.Used)
+            else
             {
-                Streams[CurrentStream][CurrentFrame].Gr[CurrentGranule] = Gr;
+                // A block can start with the second granule of a frame from the block
+                // before. If that frame isn't here, this one is a leading half and gets
+                // a frame of its own, which the generator joins up or drops.
+                PutFrameOnBack(Streams[CurrentStream], CurrentFrame);
             }
         }
         else
         {
             PutStreamOnBack(Streams, CurrentStream);
             PutFrameOnBack(Streams[CurrentStream], CurrentFrame);
+        }
 
-            // Set the granule only if it's used
-            if (Gr.Used)
-            {
-                Streams[CurrentStream][CurrentFrame].Gr[CurrentGranule] = Gr;
-            }
+        // Set the granule only if it's used, swapping it in instead of copying
+        const bool NextStream = Gr.Version == MV_1;
+        if (Gr.Used)
+        {
+            Streams[CurrentStream][CurrentFrame].Gr[CurrentGranule].Swap(Gr);
         }
 
-        if (Gr.Version == MV_1)
+        if (NextStream)
         {
             CurrentStream++;
         }
@@ -143,6 +187,7 @@ void elParser::Parse(elStreamVector& Streams, bsBitstream& IS)
             CurrentFrame++;
         }
     }
+    m_BlockData.reset();
     return;
 }
 
@@ -195,17 +240,19 @@ bool elParser::ReadGranule(bsBitstream& IS, elGranule& Gr)
     }
 
     // Read some fields in
-    Gr.Version = IS.ReadBits(2);
-    Gr.SampleRateIndex = IS.ReadBits(2);
-    Gr.ChannelMode = IS.ReadBits(2);
-    Gr.ModeExtension = IS.ReadBits(2);
-    Gr.Index = IS.ReadBit();
+    bsBitReader Reader(IS);
+    Gr.Version = Reader.ReadBits(2);
+    Gr.SampleRateIndex = Reader.ReadBits(2);
+    Gr.ChannelMode = Reader.ReadBits(2);
+    Gr.ModeExtension = Reader.ReadBits(2);
+    Gr.Index = Reader.ReadBit();
 
     // Are we at the end of the block?
     if (Gr.Version == 0 && Gr.SampleRateIndex == 0 && Gr.ChannelMode == 0 &&
         Gr.ModeExtension == 0 && Gr.Index == 0)
     {
         VERBOSE("P: " << GetName() << ": null granule encountered, end of block");
+        IS.SeekAbsolute(Reader.Tell());
         Gr.Used = false;
         return false;
     }
@@ -229,10 +276,7 @@ bool elParser::ReadGranule(bsBitstream& IS, elGranule& Gr)
     // Prepare the channel info array
     for (unsigned int i = 0; i < Gr.Channels; i++)
     {
-        elChannelInfo Channel;
-        Channel.Scfsi = 0;
-        Channel.Size = 0;
-        Gr.ChannelInfo.push_back(Channel);
+        Gr.ChannelInfo[i] = elChannelInfo();
     }
 
     // Read in scfsi
@@ -240,24 +284,25 @@ bool elParser::ReadGranule(bsBitstream& IS, elGranule& Gr)
     {
         for (unsigned int i = 0; i < Gr.Channels; i++)
         {
-            Gr.ChannelInfo[i].Scfsi = IS.ReadBits(4);
+            Gr.ChannelInfo[i].Scfsi = Reader.ReadBits(4);
         }
     }
 
     // Read in the side info
     for (unsigned int i = 0; i < Gr.Channels; i++)
     {
-        Gr.ChannelInfo[i].Size = IS.ReadBits(12);
-        Gr.ChannelInfo[i].SideInfo[0] = IS.ReadBits(32);
+        Gr.ChannelInfo[i].Size = Reader.ReadBits(12);
+        Gr.ChannelInfo[i].SideInfo[0] = Reader.ReadBits(32);
         if (Gr.Version == MV_1)
         {
-            Gr.ChannelInfo[i].SideInfo[1] = IS.ReadBits(47 - 32);
+            Gr.ChannelInfo[i].SideInfo[1] = Reader.ReadBits(47 - 32);
         }
         else
         {
-            Gr.ChannelInfo[i].SideInfo[1] = IS.ReadBits(51 - 32);
+            Gr.ChannelInfo[i].SideInfo[1] = Reader.ReadBits(51 - 32);
         }
     }
+    IS.SeekAbsolute(Reader.Tell());
 
     // Get the data size
     unsigned int DataBitCount = 0;
@@ -278,24 +323,19 @@ bool elParser::ReadGranule(bsBitstream& IS, elGranule& Gr)
     }
     Gr.DataSize /= 8;
 
-    // Read in the data
+    Gr.DataSizeBits = DataBitCount;
+
+    // Point at the data in the block instead of copying it
     if (Gr.DataSize)
     {
-        Gr.Data = shared_array<uint8_t>(new uint8_t[Gr.DataSize]);
-
-        bsBitstream OS(Gr.Data.get(), Gr.DataSize);
-        while (DataBitCount)
-        {
-            unsigned int BitsToRead = min(32, DataBitCount);
-            uint32_t Bits = IS.ReadBits(BitsToRead);
-            OS.WriteBits(Bits, BitsToRead);
-            DataBitCount -= BitsToRead;
-        }
-        OS.WriteToNextByte();
+        Gr.Data = m_BlockData;
+        Gr.DataOffset = IS.Tell();
+        IS.SeekRelative(DataBitCount);
     }
     else
     {
         Gr.Data.reset();
+        Gr.DataOffset = 0;
     }
     
     Gr.Used = true;
@@ -7,11 +7,15 @@
 #pragma once
 
 #include "Internal.h"
+#include "RingBuffer.h"
+#include <algorithm>
 
 // Some structures
 
 struct elChannelInfo
 {
+    elChannelInfo() : Scfsi(0), Size(0) {};
+
     unsigned int Scfsi;
     unsigned int Size;
 
@@ -28,6 +32,15 @@ struct elUncompressedSampleFrames
 {
     elUncompressedSampleFrames() : Mode(USM_REPLACE_ALL),
         Count(0), OffsetInOutput(0) {};
+
+    /// Trade places with Other without touching the reference count of the samples.
+    void Swap(elUncompressedSampleFrames& Other)
+    {
+        std::swap(Mode, Other.Mode);
+        std::swap(Count, Other.Count);
+        std::swap(OffsetInOutput, Other.OffsetInOutput);
+        Data.swap(Other.Data);
+    }
     
     elUncSampleMode Mode;
     unsigned int Count;
@@ -37,7 +50,12 @@ struct elUncompressedSampleFrames
 
 struct elGranule
 {
-    elGranule() : Used(false), Version(0) {};
+    elGranule() : Used(false), Version(0), DataOffset(0), DataSize(0),
+        DataSizeBits(0) {};
+
+    /// Trade places with Other. Used instead of copying while a granule goes
+    /// from the parser to the generator, since the buffers only change hands.
+    void Swap(elGranule& Other);
 
     bool Used;
 
@@ -49,20 +67,37 @@ struct elGranule
     unsigned char ModeExtension;
     unsigned char Index;
 
+    /// The main data is DataSizeBits bits starting DataOffset bits into Data.
+    /// For parsed granules Data is the buffer of the block they came from.
     shared_array<uint8_t> Data;
+    unsigned int DataOffset;
     unsigned int DataSize;
     unsigned int DataSizeBits;
 
     elUncompressedSampleFrames Uncomp;
-    std::vector<elChannelInfo> ChannelInfo;
+
+    /// The first Channels of these are used, MPEG audio has no more than 2.
+    elChannelInfo ChannelInfo[2];
 };
 
 struct elFrame
 {
     elGranule Gr[2];
+
+    void Swap(elFrame& Other)
+    {
+        Gr[0].Swap(Other.Gr[0]);
+        Gr[1].Swap(Other.Gr[1]);
+    }
 };
 
-typedef std::deque<elFrame> elStream;
+/// Lets elRingBuffer and the standard algorithms move frames around without copying them.
+inline void swap(elFrame& A, elFrame& B)
+{
+    A.Swap(B);
+}
+
+typedef elRingBuffer<elFrame> elStream;
 typedef std::vector<elStream> elStreamVector;
 
 enum
@@ -95,11 +130,24 @@ public:
     /// Get the name associated with this parser.
     virtual const std::string GetName() const;
 
-    /// Parses the entire input stream and checks to see if it's a format that can be parsed.
+    /// Make another parser of the same kind, so that blocks can be parsed on more than one thread.
+    virtual shared_ptr<elParser> Clone() const;
+
+    /// Checks the first few granules of the input stream to see if it's a format that can be parsed.
+    /// The rest of the stream is only checked when it's parsed.
     virtual bool Initialize(bsBitstream& IS);
 
+    /// Reads up to MaxGranules granules and scores how well they fit this parser. The score is the
+    /// number of granules read before the end of the block, or 0 if any of them can't be read.
+    virtual unsigned int Probe(bsBitstream& IS, unsigned int MaxGranules = 8);
+
+    /// Switch to the next best way of reading the input, for when the first block can't be
+    /// parsed after all. Returns false if there isn't one.
+    virtual bool UseRunnerUp();
+
     /// Parses the entire input stream and outputs an elStreamVector.
-    virtual void Parse(elStreamVector& Streams, bsBitstream& IS);
+    /// The granules point into BlockData, which must be the buffer that IS reads from.
+    virtual void Parse(elStreamVector& Streams, bsBitstream& IS, const shared_array<uint8_t>& BlockData);
     
 protected:
     /// Read a granule and uncompressed samples if they exist from the stream.
@@ -113,6 +161,9 @@ protected:
     
     /// The current frame number for debugging purposes.
     unsigned int m_CurrentFrame;
+
+    /// The buffer of the block being parsed, shared with the granules read from it.
+    shared_array<uint8_t> m_BlockData;
 };
 
 /// An exception thrown by the parser.
@@ -23,6 +23,11 @@ const std::string elParserForSCx::GetName() const
     return "EAL3 for SCx blocks";
 }
 
+shared_ptr<elParser> elParserForSCx::Clone() const
+{
+    return make_shared<elParserForSCx>(*this);
+}
+
 bool elParserForSCx::ReadGranuleWithUncSamples(bsBitstream& IS, elGranule& Gr)
 {
     if (IS.Eos())
@@ -19,6 +19,9 @@ public:
     /// Get the name associated with this parser.
     virtual const std::string GetName() const;
 
+    /// Make another parser of the same kind.
+    virtual shared_ptr<elParser> Clone() const;
+
 protected:
     /// Read a granule and uncompressed samples if existant from the stream.
     virtual bool ReadGranuleWithUncSamples(bsBitstream& IS, elGranule& Gr);
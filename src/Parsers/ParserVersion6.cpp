@@ -23,6 +23,11 @@ const std::string elParserVersion6::GetName() const
     return "EAL3 ver. 6 and 7";
 }
 
+shared_ptr<elParser> elParserVersion6::Clone() const
+{
+    return make_shared<elParserVersion6>(*this);
+}
+
 bool elParserVersion6::ReadGranuleWithUncSamples(bsBitstream& IS, elGranule& Gr)
 {
     if (IS.Eos())
@@ -10,15 +10,31 @@
 
 #include <mpg123.h>
 
+/// How many frames are handed to the decoder at once.
+#define PCM_FEED_FRAMES 16
+
 #ifndef min
 #define min(a, b) ( (a) < (b) ? (a) : (b) )
 #endif // min
 
+#ifndef max
+#define max(a, b) ( (a) > (b) ? (a) : (b) )
+#endif // max
+
 
 elPcmOutputStream::elPcmOutputStream(const elMpegGenerator& Gen, unsigned int StreamIndex):
     elOutputStream(Gen, StreamIndex),
     m_Decoder(NULL),
-    m_SamplesLeft(0)
+    m_SamplesLeft(0),
+    m_SkipSamples(0),
+    m_FeedStart(0),
+    m_OutputStart(0),
+    m_OutputEnd(Gen.GetFrameCount(StreamIndex)),
+    m_FeedEnd(m_OutputEnd),
+    m_MpegFrames(new uint8_t[PCM_FEED_FRAMES * MAX_MPEG_FRAME_BUFFER]),
+    m_PcmBuffer(new short[RecommendBufferSize()]),
+    m_PcmOffset(0),
+    m_PcmCount(0)
 {
     // Initialize the decoder
     m_Decoder = mpg123_new(NULL, NULL);
@@ -40,97 +56,201 @@ elPcmOutputStream::~elPcmOutputStream()
 
 unsigned int elPcmOutputStream::Read(short int* Buffer, unsigned int BufferSamples)
 {
-    // Check to make sure that we have something to decode
-    if (!m_Decoder)
+    // Start with what didn't fit last time
+    unsigned int Done = TakeStagedSamples(Buffer, BufferSamples);
+
+    // A frame is decoded straight into the buffer if the largest one fits
+    const unsigned int FrameSamples = max(1152 * GetChannels(),
+        (unsigned int)(mpg123_outblock(m_Decoder) / sizeof(short)));
+
+    while (Done < BufferSamples && m_Decoder && m_SamplesLeft && !m_Eos)
+    {
+        unsigned int Samples;
+        if (BufferSamples - Done >= FrameSamples)
+        {
+            if (!DecodeFrame(Buffer + Done, BufferSamples - Done, Samples))
+            {
+                break;
+            }
+            Done += Samples;
+        }
+        else
+        {
+            // The frame doesn't fit, so the rest of it waits for the next call
+            if (!DecodeFrame(m_PcmBuffer.get(), RecommendBufferSize(), Samples))
+            {
+                break;
+            }
+            m_PcmOffset = 0;
+            m_PcmCount = Samples;
+            Done += TakeStagedSamples(Buffer + Done, BufferSamples - Done);
+        }
+    }
+
+    // Check to make sure that we have something left to decode
+    if (!m_Decoder || (!m_SamplesLeft && !m_PcmCount))
     {
         m_Eos = true;
-        return 0;
     }
+    return Done;
+}
+
+bool elPcmOutputStream::DecodeFrame(short* Out, unsigned int Space, unsigned int& Samples)
+{
+    // Have the decoder write the frame to Out instead of its own buffer
+    mpg123_replace_buffer(m_Decoder, (unsigned char*)Out, Space * sizeof(short));
 
     // See if we can decode anything
     int Result;
     off_t DecoderFrameIndex;
-    unsigned char* InternalBuffer;
-    size_t Done;
-    Result = mpg123_decode_frame(m_Decoder, &DecoderFrameIndex, &InternalBuffer, &Done);
-
-    // If we need a new format do that and try it again
-    if (Result == MPG123_NEW_FORMAT)
+    unsigned char* DecodedBuffer;
+    size_t Decoded;
+    while (true)
     {
-        long Rate;
-        int Channels;
-        int Encoding;
-        mpg123_getformat(m_Decoder, &Rate, &Channels, &Encoding);
-        mpg123_format_none(m_Decoder);
-        mpg123_format(m_Decoder, GetSampleRate(), GetChannels(), MPG123_ENC_SIGNED_16);
-        Result = mpg123_decode_frame(m_Decoder, &DecoderFrameIndex, &InternalBuffer, &Done);
-    }
+        Result = mpg123_decode_frame(m_Decoder, &DecoderFrameIndex, &DecodedBuffer, &Decoded);
 
-    // Handle the return value
-    if (Result == MPG123_NEED_MORE)
-    {
-        if (m_CurrentFrame >= m_Gen.GetFrameCount(m_StreamIndex))
+        // If we need a new format do that and try it again
+        if (Result == MPG123_NEW_FORMAT)
         {
-            // We don't have any more
+            long Rate;
+            int Channels;
+            int Encoding;
+            mpg123_getformat(m_Decoder, &Rate, &Channels, &Encoding);
+            mpg123_format_none(m_Decoder);
+            mpg123_format(m_Decoder, GetSampleRate(), GetChannels(), MPG123_ENC_SIGNED_16);
+            Result = mpg123_decode_frame(m_Decoder, &DecoderFrameIndex, &DecodedBuffer, &Decoded);
+        }
+
+        // Handle the return value
+        if (Result == MPG123_NEED_MORE)
+        {
+            if (m_CurrentFrame >= m_FeedEnd)
+            {
+                // We don't have any more
+                m_Eos = true;
+                return false;
+            }
+            FeedNextFrames();
+        }
+        else if (Result == MPG123_NEW_FORMAT)
+        {
+            // Err... can this happen?
             m_Eos = true;
-            return 0;
+            return false;
+        }
+        else if (Result == MPG123_OK)
+        {
+            break;
         }
         else
         {
-            FeedNextFrame();
-            return Read(Buffer, BufferSamples);
+            throw (elMpg123Exception(Result));
         }
     }
-    else if (Result == MPG123_NEW_FORMAT)
+
+    // Frames outside of the frame range only prime the decoder
+    const unsigned int FrameIndex = m_FeedStart + (unsigned int)DecoderFrameIndex;
+    if (FrameIndex >= m_OutputEnd)
     {
-        // Err... can this happen?
         m_Eos = true;
-        return 0;
+        return false;
     }
-    else if (Result == MPG123_OK)
+    if (FrameIndex < m_OutputStart)
     {
+        Samples = 0;
+        return true;
     }
-    else
+
+    // Now that we have the frame
+    unsigned int NewSamples = Decoded / sizeof(short);
+    if (NewSamples > Space)
     {
-        throw (elMpg123Exception(Result));
+        Samples = 0;
+        return true;
     }
-
-    // Now that we have the buffer
-    unsigned long Samples = Done / sizeof(short);
-    if (Samples > BufferSamples)
+    if (DecodedBuffer != (unsigned char*)Out)
     {
-        return 0;
+        memcpy(Out, DecodedBuffer, Decoded);
     }
-    memcpy(Buffer, InternalBuffer, Done);
 
     // Add the uncompressed samples
-    unsigned int NewSamples;
-    NewSamples = FixupOutFrame(Buffer, Samples, DecoderFrameIndex);
+    NewSamples = FixupOutFrame(Out, NewSamples, FrameIndex);
+
+    // Leave out what comes before the range
+    if (m_SkipSamples > 0)
+    {
+        const unsigned int Skip = min(m_SkipSamples, NewSamples);
+        memmove(Out, Out + Skip, (NewSamples - Skip) * sizeof(short));
+        NewSamples -= Skip;
+        m_SkipSamples -= Skip;
+    }
+
     Samples = min(NewSamples, m_SamplesLeft);
     m_SamplesLeft -= Samples;
+    return true;
+}
+
+unsigned int elPcmOutputStream::TakeStagedSamples(short* Buffer, unsigned int BufferSamples)
+{
+    const unsigned int Samples = min(m_PcmCount, BufferSamples);
+    memcpy(Buffer, m_PcmBuffer.get() + m_PcmOffset, Samples * sizeof(short));
+    m_PcmOffset += Samples;
+    m_PcmCount -= Samples;
     return Samples;
 }
 
+void elPcmOutputStream::SetRange(unsigned long Skip, unsigned long Count)
+{
+    const unsigned long Channels = GetChannels();
+    const unsigned long Total = m_Gen.GetSampleFrameCount();
+    Skip = min(Skip, Total);
+    m_SkipSamples = Skip * Channels;
+    m_SamplesLeft = min(Count, Total - Skip) * Channels;
+    return;
+}
+
+void elPcmOutputStream::SetFrameRange(unsigned int First, unsigned int End, unsigned int Warmup)
+{
+    const unsigned int Total = m_Gen.GetFrameCount(m_StreamIndex);
+    m_OutputStart = min(First, Total);
+    m_OutputEnd = min(End, Total);
+    m_FeedStart = m_OutputStart - min(Warmup, m_OutputStart);
+    m_CurrentFrame = m_FeedStart;
+
+    // One frame past the end is fed too, in case the decoder holds on to the last one
+    m_FeedEnd = min(m_OutputEnd + 1, Total);
+
+    // The frames set the length, so cutting the last piece is up to the caller
+    m_SamplesLeft = (unsigned long)-1;
+    return;
+}
+
+unsigned long elPcmOutputStream::GetSamplesLeft() const
+{
+    return m_SamplesLeft;
+}
+
 unsigned int elPcmOutputStream::RecommendBufferSize()
 {
     return (unsigned int)mpg123_safe_buffer();
 }
 
-unsigned int elPcmOutputStream::FeedNextFrame()
+unsigned int elPcmOutputStream::FeedNextFrames()
 {
-    // A place to store the current compressed frame
-    static uint8_t MpegFrame[MAX_MPEG_FRAME_BUFFER];
     unsigned int Bytes = 0;
-    if (m_CurrentFrame < m_Gen.GetFrameCount(m_StreamIndex))
+    if (m_CurrentFrame < m_FeedEnd)
     {
-        Bytes = m_Gen.ReadFrame(MpegFrame, sizeof(MpegFrame), m_CurrentFrame++, m_StreamIndex);
+        unsigned int Count = min(PCM_FEED_FRAMES, m_FeedEnd - m_CurrentFrame);
+        Bytes = m_Gen.ReadFrames(m_MpegFrames.get(), PCM_FEED_FRAMES * MAX_MPEG_FRAME_BUFFER,
+            m_CurrentFrame, Count, m_StreamIndex);
+        m_CurrentFrame += Count;
     }
 
-    // Now feed it to the decoder
+    // Now feed them to the decoder
     if (Bytes > 0)
     {
         int Result;
-        Result = mpg123_feed(m_Decoder, MpegFrame, Bytes);
+        Result = mpg123_feed(m_Decoder, m_MpegFrames.get(), Bytes);
     }
     return Bytes;
 }
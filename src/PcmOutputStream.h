@@ -19,21 +19,54 @@ public:
     elPcmOutputStream(const elMpegGenerator& Gen, unsigned int StreamIndex);
     virtual ~elPcmOutputStream();
 
-    /// Read PCM samples from the stream.
+    /// Read PCM samples from the stream. The buffer is filled unless the stream ends. As many
+    /// frames as fit are decoded straight into it, and the rest of the last one is kept for later.
     virtual unsigned int Read(short* Buffer, unsigned int BufferSamples);
 
+    /// Leave out the first Skip sample frames, and stop after Count more.
+    void SetRange(unsigned long Skip, unsigned long Count);
+
+    /// Only output the frames from First up to End, to decode a stream in pieces. Up to Warmup
+    /// frames before First are decoded and thrown away so the decoder has what they leave over.
+    void SetFrameRange(unsigned int First, unsigned int End, unsigned int Warmup);
+
+    /// Get the most samples that are still to be read.
+    unsigned long GetSamplesLeft() const;
+
     /// Get the size of the buffer that should be used.
     static unsigned int RecommendBufferSize();
 
 protected:
-    /// Feed the next frame into the decoder.
-    unsigned int FeedNextFrame();
+    /// Feed the next few frames into the decoder at once.
+    unsigned int FeedNextFrames();
+
+    /// Decode the next frame into Out, which has room for Space samples, and set Samples to
+    /// how many of them are for the output. Returns false at the end of the stream.
+    bool DecodeFrame(short* Out, unsigned int Space, unsigned int& Samples);
+
+    /// Copy the samples left over in the staging buffer into Buffer.
+    unsigned int TakeStagedSamples(short* Buffer, unsigned int BufferSamples);
     
     /// Add the uncompressed samples to the frame.
     unsigned int FixupOutFrame(short* Buffer, unsigned int BufferSamples, unsigned int FrameIndex);
 
     mpg123_handle* m_Decoder;
     unsigned long m_SamplesLeft;
+    unsigned long m_SkipSamples;
+
+    /// The first frame fed to the decoder, the frames that are output, and the frame after the last one fed.
+    unsigned int m_FeedStart;
+    unsigned int m_OutputStart;
+    unsigned int m_OutputEnd;
+    unsigned int m_FeedEnd;
+
+    /// A place to store the compressed frames being fed to the decoder.
+    shared_array<uint8_t> m_MpegFrames;
+
+    /// Where a frame is decoded when it doesn't fit in the caller's buffer, and what's left of it.
+    shared_array<short> m_PcmBuffer;
+    unsigned int m_PcmOffset;
+    unsigned int m_PcmCount;
 };
 
 class elMpg123Exception : public std::exception
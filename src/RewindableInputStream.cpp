@@ -0,0 +1,197 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#include "Internal.h"
+#include "RewindableInputStream.h"
+
+/// How much is read from the source at a time.
+#define REWINDABLE_READ_SIZE 65536
+
+
+elRewindableStreamBuf::elRewindableStreamBuf() :
+    m_Source(NULL),
+    m_BufferStart(0),
+    m_Marked(false)
+{
+    return;
+}
+
+elRewindableStreamBuf::~elRewindableStreamBuf()
+{
+    return;
+}
+
+void elRewindableStreamBuf::SetSource(std::streambuf* Source)
+{
+    m_Source = Source;
+    m_Buffer.clear();
+    m_BufferStart = 0;
+    m_Marked = false;
+    SetIndex(0);
+    return;
+}
+
+std::streambuf* elRewindableStreamBuf::GetSource() const
+{
+    return m_Source;
+}
+
+void elRewindableStreamBuf::Mark()
+{
+    // Drop what's before the mark first, it can't be gone back to anyway
+    Release();
+    m_Marked = true;
+    return;
+}
+
+void elRewindableStreamBuf::Release()
+{
+    const size_t Index = gptr() - eback();
+    m_Buffer.erase(m_Buffer.begin(), m_Buffer.begin() + Index);
+    m_BufferStart += Index;
+    m_Marked = false;
+    SetIndex(0);
+    return;
+}
+
+elRewindableStreamBuf::int_type elRewindableStreamBuf::underflow()
+{
+    if (gptr() == egptr() && !Fill())
+    {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+}
+
+elRewindableStreamBuf::pos_type elRewindableStreamBuf::seekoff(off_type Offset, std::ios_base::seekdir Dir, std::ios_base::openmode Which)
+{
+    if (!(Which & std::ios_base::in) || !m_Source)
+    {
+        return pos_type(off_type(-1));
+    }
+
+    off_type NewOffset;
+    switch (Dir)
+    {
+        case std::ios_base::beg:
+            NewOffset = Offset;
+            break;
+        case std::ios_base::cur:
+            NewOffset = m_BufferStart + (gptr() - eback()) + Offset;
+            break;
+        default:
+            // The end isn't known until the whole source has been read
+            return pos_type(off_type(-1));
+    }
+
+    if (!Go(NewOffset))
+    {
+        return pos_type(off_type(-1));
+    }
+    return pos_type(NewOffset);
+}
+
+elRewindableStreamBuf::pos_type elRewindableStreamBuf::seekpos(pos_type Position, std::ios_base::openmode Which)
+{
+    return seekoff(off_type(Position), std::ios_base::beg, Which);
+}
+
+void elRewindableStreamBuf::SetIndex(size_t Index)
+{
+    if (m_Buffer.empty())
+    {
+        setg(NULL, NULL, NULL);
+        return;
+    }
+    char* Data = &m_Buffer[0];
+    setg(Data, Data + Index, Data + m_Buffer.size());
+    return;
+}
+
+bool elRewindableStreamBuf::Fill()
+{
+    if (!m_Source)
+    {
+        return false;
+    }
+
+    // Nothing that has been read has to be kept unless it's marked
+    size_t Index = gptr() - eback();
+    if (!m_Marked)
+    {
+        m_Buffer.erase(m_Buffer.begin(), m_Buffer.begin() + Index);
+        m_BufferStart += Index;
+        Index = 0;
+    }
+
+    const size_t Size = m_Buffer.size();
+    m_Buffer.resize(Size + REWINDABLE_READ_SIZE);
+    const std::streamsize Read = m_Source->sgetn(&m_Buffer[Size], REWINDABLE_READ_SIZE);
+    m_Buffer.resize(Size + (Read > 0 ? Read : 0));
+    SetIndex(Index);
+    return Read > 0;
+}
+
+bool elRewindableStreamBuf::Go(off_type Position)
+{
+    if (Position < m_BufferStart)
+    {
+        return false;
+    }
+
+    // Pass over the whole buffer until the position is in it
+    while (Position > m_BufferStart + (off_type)m_Buffer.size())
+    {
+        SetIndex(m_Buffer.size());
+        if (!Fill())
+        {
+            return false;
+        }
+    }
+    SetIndex(Position - m_BufferStart);
+    return true;
+}
+
+
+elRewindableInputStream::elRewindableInputStream() :
+    std::istream(NULL)
+{
+    return;
+}
+
+elRewindableInputStream::~elRewindableInputStream()
+{
+    return;
+}
+
+void elRewindableInputStream::Open(std::streambuf* Source)
+{
+    m_Buffer.SetSource(Source);
+    rdbuf(&m_Buffer);
+    return;
+}
+
+bool elRewindableInputStream::IsOpen() const
+{
+    return m_Buffer.GetSource() != NULL;
+}
+
+void elRewindableInputStream::Mark()
+{
+    m_Buffer.Mark();
+    return;
+}
+
+void elRewindableInputStream::Release()
+{
+    m_Buffer.Release();
+    return;
+}
+
+bool elRewindableInputStream::IsSeekable(std::streambuf* Buffer)
+{
+    return Buffer && Buffer->pubseekoff(0, std::ios_base::cur, std::ios_base::in) != std::streampos(-1);
+}
@@ -0,0 +1,85 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#pragma once
+
+#include "Internal.h"
+#include <istream>
+
+/**
+ * A stream buffer over a source that can only be read forwards, like a pipe. While it is
+ * marked it keeps everything that has been read, so that it can seek back over it. Once it
+ * is released it only holds on to what hasn't been read yet. Seeking forwards reads and
+ * drops what's in between, and seeking from the end isn't possible.
+ */
+class elRewindableStreamBuf : public std::streambuf
+{
+public:
+    elRewindableStreamBuf();
+    virtual ~elRewindableStreamBuf();
+
+    /// Set the stream buffer to read from, and start at position 0.
+    void SetSource(std::streambuf* Source);
+
+    std::streambuf* GetSource() const;
+
+    /// Keep everything read from the current position on.
+    void Mark();
+
+    /// Drop everything before the current position, and stop keeping what is read.
+    void Release();
+
+protected:
+    virtual int_type underflow();
+    virtual pos_type seekoff(off_type Offset, std::ios_base::seekdir Dir, std::ios_base::openmode Which);
+    virtual pos_type seekpos(pos_type Position, std::ios_base::openmode Which);
+
+    /// Point the get area at the buffer, with the current position at Index.
+    void SetIndex(size_t Index);
+
+    /// Read more from the source onto the end of the buffer. Returns false at the end of the source.
+    bool Fill();
+
+    /// Go to Position, reading up to it if it is ahead. Returns false if it can't be reached.
+    bool Go(off_type Position);
+
+    std::streambuf* m_Source;
+    std::vector<char> m_Buffer;
+
+    /// The position of the first byte in the buffer.
+    off_type m_BufferStart;
+
+    bool m_Marked;
+};
+
+/**
+ * An input stream for stdin and other inputs that can't seek. The block loaders can look at
+ * the start of the input and go back to it while elBlockLoaderSelector marks it, and after
+ * that the blocks are read strictly forwards.
+ */
+class elRewindableInputStream : public std::istream
+{
+public:
+    elRewindableInputStream();
+    virtual ~elRewindableInputStream();
+
+    /// Read from Source, which stays owned by the caller.
+    void Open(std::streambuf* Source);
+
+    bool IsOpen() const;
+
+    /// See elRewindableStreamBuf::Mark().
+    void Mark();
+
+    /// See elRewindableStreamBuf::Release().
+    void Release();
+
+    /// Can the stream buffer go back to where it has been?
+    static bool IsSeekable(std::streambuf* Buffer);
+
+protected:
+    elRewindableStreamBuf m_Buffer;
+};
@@ -0,0 +1,156 @@
+/*
+    EA Layer 3 Extractor/Decoder
+    Copyright (C) 2010-2011, Ben Moench.
+    See License.txt
+*/
+
+#pragma once
+
+#include "Internal.h"
+#include <algorithm>
+
+#define RING_BUFFER_MIN_CAPACITY 16
+
+
+/// A queue of items kept in one array of slots that are reused as the front is taken
+/// off and the back is added to. The slots are only allocated when the ring has to
+/// grow, so a ring that lives across many blocks stops allocating once it's big
+/// enough. Removed items are reset to T() straight away, so they don't hold on to
+/// anything. It has the part of the std::deque interface that elStream needs.
+template <typename T>
+class elRingBuffer
+{
+public:
+    inline elRingBuffer() :
+        m_Head(0),
+        m_Size(0)
+    {
+        return;
+    }
+
+    inline unsigned int size() const
+    {
+        return m_Size;
+    }
+
+    inline bool empty() const
+    {
+        return m_Size == 0;
+    }
+
+    inline unsigned int capacity() const
+    {
+        return m_Slots.size();
+    }
+
+    inline T& operator[](unsigned int Index)
+    {
+        assert(Index < m_Size);
+        return m_Slots[(m_Head + Index) & (m_Slots.size() - 1)];
+    }
+
+    inline const T& operator[](unsigned int Index) const
+    {
+        assert(Index < m_Size);
+        return m_Slots[(m_Head + Index) & (m_Slots.size() - 1)];
+    }
+
+    inline T& front()
+    {
+        return (*this)[0];
+    }
+
+    inline T& back()
+    {
+        return (*this)[m_Size - 1];
+    }
+
+    /// Add an item at the back and return it. It is always T().
+    inline T& push_back()
+    {
+        Reserve(m_Size + 1);
+        m_Size++;
+        return back();
+    }
+
+    inline void push_back(const T& Item)
+    {
+        push_back() = Item;
+        return;
+    }
+
+    /// Take Count items off the front.
+    inline void pop_front(unsigned int Count = 1)
+    {
+        assert(Count <= m_Size);
+
+        for (unsigned int i = 0; i < Count; i++)
+        {
+            front() = T();
+            m_Head = (m_Head + 1) & (m_Slots.size() - 1);
+            m_Size--;
+        }
+        return;
+    }
+
+    /// Add T() items at the back or take them off, to have Size items.
+    inline void resize(unsigned int Size)
+    {
+        Reserve(Size);
+        while (m_Size > Size)
+        {
+            back() = T();
+            m_Size--;
+        }
+        m_Size = Size;
+        return;
+    }
+
+    /// Remove all items, keeping the slots for later.
+    inline void clear()
+    {
+        resize(0);
+        m_Head = 0;
+        return;
+    }
+
+    inline void swap(elRingBuffer& Other)
+    {
+        m_Slots.swap(Other.m_Slots);
+        std::swap(m_Head, Other.m_Head);
+        std::swap(m_Size, Other.m_Size);
+        return;
+    }
+
+    /// Make sure that there are slots for Capacity items.
+    inline void Reserve(unsigned int Capacity)
+    {
+        if (Capacity <= m_Slots.size())
+        {
+            return;
+        }
+
+        // The capacity stays a power of 2 so that the index only needs a mask
+        unsigned int NewCapacity = std::max<unsigned int>(m_Slots.size(), RING_BUFFER_MIN_CAPACITY);
+        while (NewCapacity < Capacity)
+        {
+            NewCapacity *= 2;
+        }
+
+        // Swap the items over in order, starting from slot 0
+        std::vector<T> Slots(NewCapacity);
+        for (unsigned int i = 0; i < m_Size; i++)
+        {
+            using std::swap;
+            swap(Slots[i], (*this)[i]);
+        }
+        m_Slots.swap(Slots);
+        m_Head = 0;
+        return;
+    }
+
+protected:
+    std::vector<T> m_Slots;
+    unsigned int m_Head;
+    unsigned int m_Size;
+};
@@ -7,16 +7,1944 @@
 #include "Internal.h"
 
 #include <fstream>
+#include <sstream>
 #include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "Version.h"
 #include "AllFormats.h"
+#include "DecodePipeline.h"
+#include "Interleave.h"
+#include "Generator.h"
+#include "Parser.h"
 #include "MpegGenerator.h"
 #include "MpegOutputStream.h"
 #include "PcmOutputStream.h"
+#include "MappedInputStream.h"
+#include "Loaders/AsfPtLoader.h"
+#include "Loaders/HeaderlessLoader.h"
+#include "Writers/HeaderlessWriter.h"
+#include "BatchDecoder.h"
+#include "FileDecoder.h"
+#include "BoundedQueue.h"
+#include "Parsers/ParserVersion6.h"
+#include "Bitstream.h"
 
 int g_Verbose = 1;
 
+/// How many checks have failed in the self test so far.
+static unsigned int g_FailedChecks = 0;
+
+#define CHECK(Condition) CheckCondition((Condition), #Condition, __LINE__)
+
+static void CheckCondition(bool Passed, const char* Condition, unsigned int Line)
+{
+    if (!Passed)
+    {
+        std::cout << "    Check failed on line " << Line << ": " << Condition << std::endl;
+        g_FailedChecks++;
+    }
+    return;
+}
+
+/**
+ * Make a stereo MPEG-1 frame whose side info holds Number, so that it can be told apart
+ * after parsing. Each channel of each granule has ChannelBits bits of main data.
+ */
+static elFrame MakeTestFrame(unsigned int Number, unsigned int ChannelBits = 128)
+{
+    const unsigned int DataSize = ChannelBits * 2 / 8;
+    shared_array<uint8_t> Data(new uint8_t[DataSize]);
+    for (unsigned int i = 0; i < DataSize; i++)
+    {
+        Data[i] = (uint8_t)(Number * 31 + i);
+    }
+
+    elFrame Fr;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        elGranule& Gr = Fr.Gr[i];
+        Gr.Used = true;
+        Gr.Version = MV_1;
+        Gr.SampleRateIndex = 0;
+        Gr.SampleRate = 44100;
+        Gr.ChannelMode = CM_JOINT_STEREO;
+        Gr.Channels = 2;
+        Gr.ModeExtension = 0;
+        Gr.Index = i;
+        Gr.Data = Data;
+        Gr.DataOffset = 0;
+        Gr.DataSize = DataSize;
+        Gr.DataSizeBits = ChannelBits * 2;
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            Gr.ChannelInfo[j].Size = ChannelBits;
+            Gr.ChannelInfo[j].SideInfo[0] = Number;
+            Gr.ChannelInfo[j].SideInfo[1] = i;
+        }
+    }
+    return Fr;
+}
+
+/// The frame number that MakeTestFrame() put in a granule.
+static unsigned int GetTestFrameNumber(const elGranule& Gr)
+{
+    return Gr.ChannelInfo[0].SideInfo[0];
+}
+
+/**
+ * Add the granules of frames First to Last - 1 to Bytes, for each of Streams streams.
+ * Stream s gets frame numbers starting at s * 1000. If FirstHalf or LastHalf are set
+ * only the second granule of the first frame or the first granule of the last frame
+ * is written, so the frame is split across blocks.
+ */
+static void AppendTestFrames(std::vector<uint8_t>& Bytes, unsigned int First, unsigned int Last,
+    unsigned int Streams = 1, bool FirstHalf = false, bool LastHalf = false)
+{
+    elGenerator Gen;
+    for (unsigned int i = First; i < Last; i++)
+    {
+        for (unsigned int j = 0; j < Streams; j++)
+        {
+            elFrame Fr = MakeTestFrame(j * 1000 + i);
+            Fr.Gr[0].Used = !(FirstHalf && i == First);
+            Fr.Gr[1].Used = !(LastHalf && i == Last - 1);
+            Gen.AddFrameFromStream(Fr);
+        }
+
+        elBlock Block;
+        Gen.Generate(Block, false);
+        Bytes.insert(Bytes.end(), Block.Data.get(), Block.Data.get() + Block.Size);
+    }
+    return;
+}
+
+static elBlock MakeTestBlock(const std::vector<uint8_t>& Bytes, unsigned long SampleCount, unsigned long Offset = 0)
+{
+    elBlock Block;
+    Block.Data = shared_array<uint8_t>(new uint8_t[Bytes.size()]);
+    std::copy(Bytes.begin(), Bytes.end(), Block.Data.get());
+    Block.Size = Bytes.size();
+    Block.SampleCount = SampleCount;
+    Block.Offset = Offset;
+    return Block;
+}
+
+/// Check that Str holds the complete frames numbered First to Last - 1.
+static void CheckTestFrames(const elStream& Str, unsigned int First, unsigned int Last)
+{
+    CHECK(Str.size() == Last - First);
+    for (unsigned int i = 0; i < Str.size() && i < Last - First; i++)
+    {
+        CHECK(Str[i].Gr[0].Used && Str[i].Gr[1].Used);
+        CHECK(GetTestFrameNumber(Str[i].Gr[0]) == First + i);
+        CHECK(GetTestFrameNumber(Str[i].Gr[1]) == First + i);
+    }
+    return;
+}
+
+/// Two blocks of two streams with frame 2 split between them.
+static void MakeSplitFrameBlocks(elBlock& First, elBlock& Second)
+{
+    std::vector<uint8_t> Bytes;
+    AppendTestFrames(Bytes, 0, 3, 2, false, true);
+    First = MakeTestBlock(Bytes, 2 * 1152 + 576);
+
+    Bytes.clear();
+    AppendTestFrames(Bytes, 2, 5, 2, true, false);
+    Second = MakeTestBlock(Bytes, 576 + 2 * 1152);
+    return;
+}
+
+static void TestSplitFrameFragments()
+{
+    elBlock First, Second;
+    MakeSplitFrameBlocks(First, Second);
+
+    // The blocks parsed one after the other
+    elMpegGenerator Gen;
+    CHECK(Gen.Initialize(First, make_shared<elParser>()));
+    elStreamVector Pending, Parsed;
+    Gen.ParseBlockFrames(First, Pending, Parsed);
+    CHECK(Parsed.size() == 2);
+    CheckTestFrames(Parsed[0], 0, 2);
+    Gen.ParseBlockFrames(Second, Pending, Parsed);
+    CheckTestFrames(Parsed[0], 2, 5);
+    CheckTestFrames(Parsed[1], 1002, 1005);
+
+    // The same blocks parsed on their own and merged should give the same frames
+    shared_ptr<elParser> Parser = Gen.CloneParser();
+    elStreamVector FirstFragment, SecondFragment;
+    Gen.ParseBlockFragment(*Parser, First, FirstFragment);
+    Gen.ParseBlockFragment(*Parser, Second, SecondFragment);
+    CHECK(SecondFragment.size() == 2);
+    CHECK(SecondFragment[0].size() == 3);
+
+    Pending.clear();
+    Gen.MergeBlockFragment(FirstFragment, Pending, Parsed);
+    CheckTestFrames(Parsed[0], 0, 2);
+    CheckTestFrames(Parsed[1], 1000, 1002);
+    Gen.MergeBlockFragment(SecondFragment, Pending, Parsed);
+    CheckTestFrames(Parsed[0], 2, 5);
+    CheckTestFrames(Parsed[1], 1002, 1005);
+    CHECK(Pending[0].empty());
+    return;
+}
+
+static void TestSplitFrameWithoutStart()
+{
+    elBlock First, Second;
+    MakeSplitFrameBlocks(First, Second);
+
+    // Without the block before, the half frame can't be finished and is dropped
+    elMpegGenerator Gen;
+    CHECK(Gen.Initialize(First, make_shared<elParser>()));
+    shared_ptr<elParser> Parser = Gen.CloneParser();
+    elStreamVector Fragment, Pending, Parsed;
+    Gen.ParseBlockFragment(*Parser, Second, Fragment);
+    Gen.MergeBlockFragment(Fragment, Pending, Parsed);
+    CheckTestFrames(Parsed[0], 3, 5);
+    CheckTestFrames(Parsed[1], 1003, 1005);
+    CHECK(Pending[0].empty());
+    return;
+}
+
+/// Hands out blocks made in memory as if they were read from a file.
+class elTestBlockLoader : public elBlockLoader
+{
+public:
+    elTestBlockLoader(const std::vector<elBlock>& Blocks) :
+        m_Blocks(Blocks)
+    {
+        return;
+    }
+
+    virtual const std::string GetName() const
+    {
+        return "Test";
+    }
+
+    virtual bool ReadNextBlock(elBlock& Block)
+    {
+        if (m_CurrentBlockIndex >= m_Blocks.size())
+        {
+            return false;
+        }
+        Block = m_Blocks[m_CurrentBlockIndex++];
+        return true;
+    }
+
+    virtual bool SeekToBlock(std::streamoff Offset, unsigned int Index)
+    {
+        if (Index >= m_Blocks.size() || m_Blocks[Index].Offset != Offset)
+        {
+            return false;
+        }
+        m_CurrentBlockIndex = Index;
+        return true;
+    }
+
+private:
+    std::vector<elBlock> m_Blocks;
+};
+
+/**
+ * Make Count blocks of one stream with three frames starting in each, where the
+ * last frame of a block is split with the next one. Block b starts at sample
+ * frame 3456 * b - 576, and the frames are 1152 sample frames long.
+ */
+static std::vector<elBlock> MakeSplitFrameFile(unsigned int Count)
+{
+    std::vector<elBlock> Blocks;
+    for (unsigned int i = 0; i < Count; i++)
+    {
+        const bool FirstHalf = i > 0;
+        const bool LastHalf = i + 1 < Count;
+        const unsigned int First = FirstHalf ? 3 * i - 1 : 0;
+        const unsigned int Last = 3 * i + 3;
+
+        std::vector<uint8_t> Bytes;
+        AppendTestFrames(Bytes, First, Last, 1, FirstHalf, LastHalf);
+        const unsigned int Granules = 2 * (Last - First) - FirstHalf - LastHalf;
+        Blocks.push_back(MakeTestBlock(Bytes, Granules * 576, i * 100));
+    }
+    return Blocks;
+}
+
+/// Decode the sample frames from First on with the pipeline, returning the frames made and where they start.
+static unsigned int DecodeTestRange(const std::vector<elBlock>& Blocks, uint64_t First, unsigned int Threads,
+    uint64_t& FirstSample, const elIndexPart* Index = NULL)
+{
+    elTestBlockLoader Loader(Blocks);
+    elBlock FirstBlock;
+    Loader.ReadNextBlock(FirstBlock);
+
+    elMpegGenerator Gen;
+    CHECK(Gen.Initialize(FirstBlock, Loader.CreateParser()));
+    elDecodePipeline Pipeline(Loader, Gen);
+    Pipeline.SetParserThreads(Threads);
+    Pipeline.SetSampleRange(First, elDecodePipeline::NO_SAMPLE, Index);
+    Pipeline.Run(FirstBlock);
+
+    FirstSample = Pipeline.GetFirstSample();
+    return Gen.GetParsedFrameCount();
+}
+
+static void TestRangeStartingMidFrame()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(3);
+
+    // Frame 3 is the first one in block 1, which starts with the end of frame 2
+    for (unsigned int Threads = 1; Threads <= 4; Threads += 3)
+    {
+        uint64_t FirstSample = 0;
+        CHECK(DecodeTestRange(Blocks, 3 * 1152, Threads, FirstSample) == 7);
+        CHECK(FirstSample == 2 * 1152);
+    }
+    return;
+}
+
+static void TestRangeAfterSkippedBlocks()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(3);
+
+    // Here the start of frame 5 is in a block that the loader skips
+    for (unsigned int Threads = 1; Threads <= 4; Threads += 3)
+    {
+        uint64_t FirstSample = 0;
+        CHECK(DecodeTestRange(Blocks, 6 * 1152, Threads, FirstSample) == 4);
+        CHECK(FirstSample == 5 * 1152);
+    }
+    return;
+}
+
+/// Index the blocks by decoding all of them.
+static elIndexPart MakeTestIndex(const std::vector<elBlock>& Blocks)
+{
+    elTestBlockLoader Loader(Blocks);
+    elBlock FirstBlock;
+    Loader.ReadNextBlock(FirstBlock);
+
+    elMpegGenerator Gen;
+    CHECK(Gen.Initialize(FirstBlock, Loader.CreateParser()));
+    elIndexPart Part;
+    elDecodePipeline Pipeline(Loader, Gen);
+    Pipeline.SetIndexPart(&Part);
+    Pipeline.Run(FirstBlock);
+    return Part;
+}
+
+static void TestIndexSeekMidFrame()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(5);
+    const elIndexPart Index = MakeTestIndex(Blocks);
+    CHECK(Index.Blocks.size() == 5);
+    CHECK(Index.FindBlock(9 * 1152) == 3);
+
+    // Frame 9 is in block 3, which starts with the end of frame 8 from block 2
+    for (unsigned int Threads = 1; Threads <= 4; Threads += 3)
+    {
+        uint64_t FirstSample = 0;
+        CHECK(DecodeTestRange(Blocks, 9 * 1152, Threads, FirstSample, &Index) == 7);
+        CHECK(FirstSample == 8 * 1152);
+    }
+    return;
+}
+
+static void TestStaleIndex()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(5);
+    elIndexPart Index = MakeTestIndex(Blocks);
+    CHECK(Index.Blocks.size() == 5);
+
+    // The loader can't go to a block that isn't there, so it reads up to the range instead
+    Index.Blocks[2].Offset++;
+    uint64_t FirstSample = 0;
+    CHECK(DecodeTestRange(Blocks, 9 * 1152, 1, FirstSample, &Index) == 7);
+    CHECK(FirstSample == 8 * 1152);
+    return;
+}
+
+/// Put the blocks through Gen one after the other.
+static void ParseTestBlocks(elMpegGenerator& Gen, const std::vector<elBlock>& Blocks)
+{
+    CHECK(Gen.Initialize(Blocks[0], make_shared<elParser>()));
+    for (unsigned int i = 0; i < Blocks.size(); i++)
+    {
+        Gen.ParseBlock(Blocks[i]);
+    }
+    Gen.DoneParsingBlocks();
+    return;
+}
+
+/// Decode a stream BufferSamples at a time, checking that only the last read comes up short.
+static std::vector<short> ReadTestPcm(const elMpegGenerator& Gen, unsigned int BufferSamples)
+{
+    std::vector<short> Samples;
+    std::vector<short> Buffer(BufferSamples);
+    shared_ptr<elPcmOutputStream> Stream = Gen.CreatePcmStream(0);
+    bool Short = false;
+    while (!Stream->Eos())
+    {
+        const unsigned int Count = Stream->Read(&Buffer[0], BufferSamples);
+        CHECK(!Short);
+        Short = Count < BufferSamples;
+        Samples.insert(Samples.end(), Buffer.begin(), Buffer.begin() + Count);
+    }
+    return Samples;
+}
+
+static void TestPcmReadFillsBuffer()
+{
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, MakeSplitFrameFile(4));
+    const std::vector<short> Whole = ReadTestPcm(Gen, elPcmOutputStream::RecommendBufferSize());
+    CHECK(!Whole.empty());
+
+    // Between one and two frames of stereo samples
+    CHECK(ReadTestPcm(Gen, 3000) == Whole);
+    return;
+}
+
+static void TestPcmReadLessThanAFrame()
+{
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, MakeSplitFrameFile(4));
+    const std::vector<short> Whole = ReadTestPcm(Gen, elPcmOutputStream::RecommendBufferSize());
+    CHECK(ReadTestPcm(Gen, 100) == Whole);
+    return;
+}
+
+/// Interleave Frames sample frames of streams with the given channel counts and compare it to doing it by hand.
+static void CheckInterleave(const std::vector<unsigned int>& Channels, unsigned int Frames)
+{
+    unsigned int Total = 0;
+    std::vector< std::vector<short> > Streams(Channels.size());
+    std::vector<const short*> Inputs(Channels.size());
+    for (unsigned int i = 0; i < Channels.size(); i++)
+    {
+        Streams[i].resize(Frames * Channels[i] + 1);
+        for (unsigned int j = 0; j < Streams[i].size(); j++)
+        {
+            Streams[i][j] = (short)(i * 10000 + j);
+        }
+        Inputs[i] = &Streams[i][0];
+        Total += Channels[i];
+    }
+
+    // One more sample frame than is interleaved, to catch writing past the end
+    std::vector<short> Output(Frames * Total + Total, -1);
+    InterleaveStreams(&Output[0], &Inputs[0], &Channels[0], Channels.size(), Frames);
+
+    unsigned int Offset = 0;
+    for (unsigned int i = 0; i < Channels.size(); i++)
+    {
+        for (unsigned int j = 0; j < Frames; j++)
+        {
+            for (unsigned int k = 0; k < Channels[i]; k++)
+            {
+                CHECK(Output[j * Total + Offset + k] == Streams[i][j * Channels[i] + k]);
+            }
+        }
+        Offset += Channels[i];
+    }
+    for (unsigned int i = Frames * Total; i < Output.size(); i++)
+    {
+        CHECK(Output[i] == -1);
+    }
+    return;
+}
+
+static void TestInterleaveStereoStreams()
+{
+    // These layouts have SIMD versions, and 37 sample frames leave some over for the scalar loop
+    std::vector<unsigned int> Channels(2, 2);
+    CheckInterleave(Channels, 37);
+    Channels.push_back(2);
+    CheckInterleave(Channels, 37);
+    Channels.push_back(2);
+    CheckInterleave(Channels, 37);
+    CheckInterleave(std::vector<unsigned int>(2, 1), 37);
+    return;
+}
+
+static void TestInterleaveMixedStreams()
+{
+    std::vector<unsigned int> Channels;
+    Channels.push_back(1);
+    Channels.push_back(2);
+    Channels.push_back(1);
+    CheckInterleave(Channels, 37);
+    CheckInterleave(std::vector<unsigned int>(2, 2), 0);
+    return;
+}
+
+/// Keeps the frames of one stream, like an MP3 file would.
+class elTestFrameSink : public elMpegFrameSink
+{
+public:
+    elTestFrameSink(unsigned int Stream = 0) :
+        m_Stream(Stream)
+    {
+        return;
+    }
+
+    virtual void WriteFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size)
+    {
+        if (StreamIndex == m_Stream)
+        {
+            Bytes.insert(Bytes.end(), Data, Data + Size);
+        }
+    }
+
+    virtual void PatchVbrFrame(unsigned int StreamIndex, const uint8_t* Data, unsigned int Size)
+    {
+        if (StreamIndex == m_Stream)
+        {
+            std::copy(Data, Data + Size, Bytes.begin());
+        }
+    }
+
+    std::vector<uint8_t> Bytes;
+
+private:
+    unsigned int m_Stream;
+};
+
+/**
+ * Make blocks of four frames, where a run of Long frames in the middle is a little
+ * too big for the highest bitrate. Each of them borrows a few more bytes from the
+ * frame before it than the one after it does, all the way back to the start of the run.
+ */
+static std::vector<elBlock> MakeBorrowingFile(unsigned int Long)
+{
+    std::vector<elBlock> Blocks;
+    std::vector<uint8_t> Bytes;
+    elGenerator Generator;
+    const unsigned int Count = Long + 20;
+    for (unsigned int i = 0; i < Count; i++)
+    {
+        // 1048 bytes with the header, where 320 kbit/s at 44100 Hz has room for 1044
+        const bool IsLong = i >= 10 && i < Long + 10;
+        Generator.AddFrameFromStream(MakeTestFrame(i, IsLong ? 2024 : 128));
+
+        elBlock Block;
+        Generator.Generate(Block, false);
+        Bytes.insert(Bytes.end(), Block.Data.get(), Block.Data.get() + Block.Size);
+        if (i % 4 == 3 || i + 1 == Count)
+        {
+            Blocks.push_back(MakeTestBlock(Bytes, (i % 4 + 1) * 1152, Blocks.size()));
+            Bytes.clear();
+        }
+    }
+    return Blocks;
+}
+
+/// Get the MP3 file that stream Stream of the blocks makes, streamed with LookAhead or all at once if it's 0.
+static std::vector<uint8_t> MakeTestMp3(const std::vector<elBlock>& Blocks, unsigned int LookAhead, unsigned int Stream = 0)
+{
+    elMpegGenerator Gen;
+    elTestFrameSink Sink(Stream);
+    CHECK(Gen.Initialize(Blocks[0], make_shared<elParser>()));
+    if (LookAhead)
+    {
+        Gen.SetStreaming(&Sink, LookAhead);
+    }
+    for (unsigned int i = 0; i < Blocks.size(); i++)
+    {
+        Gen.ParseBlock(Blocks[i]);
+    }
+    Gen.DoneParsingBlocks();
+    if (LookAhead)
+    {
+        return Sink.Bytes;
+    }
+
+    uint8_t Buffer[MAX_MPEG_FRAME_BUFFER];
+    for (unsigned int i = 0; i < Gen.GetFrameCount(Stream); i++)
+    {
+        const unsigned int Size = Gen.ReadFrame(Buffer, sizeof(Buffer), i, Stream);
+        Sink.Bytes.insert(Sink.Bytes.end(), Buffer, Buffer + Size);
+    }
+    return Sink.Bytes;
+}
+
+static void TestStreamingLongBorrowing()
+{
+    // 100 frames borrowing 4 more bytes each is still under the 511 an MPEG-1 frame can
+    // borrow, but goes back much further than the look-ahead
+    const std::vector<elBlock> Blocks = MakeBorrowingFile(100);
+    const std::vector<uint8_t> Whole = MakeTestMp3(Blocks, 0);
+    CHECK(!Whole.empty());
+    CHECK(MakeTestMp3(Blocks, 32) == Whole);
+    return;
+}
+
+static void TestStreamingShortLookAhead()
+{
+    const std::vector<elBlock> Blocks = MakeBorrowingFile(20);
+    const std::vector<uint8_t> Whole = MakeTestMp3(Blocks, 0);
+    CHECK(MakeTestMp3(Blocks, 1) == Whole);
+    return;
+}
+
+/// Reads the start of a block like elParser, but can't parse a whole one.
+class elTestFailingParser : public elParser
+{
+public:
+    virtual const std::string GetName() const
+    {
+        return "Failing";
+    }
+
+    virtual void Parse(elStreamVector& /*Streams*/, bsBitstream& /*IS*/, const shared_array<uint8_t>& /*BlockData*/)
+    {
+        throw (elParserException("The test parser always fails."));
+    }
+};
+
+static void TestParserFallback()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(2);
+
+    // Both parsers read the whole probe and the tie goes to the failing one
+    shared_ptr<elParserSelector> Selector = make_shared<elParserSelector>();
+    Selector->SelectorListAdd(make_shared<elTestFailingParser>());
+    Selector->SelectorListAdd(make_shared<elParser>());
+
+    elMpegGenerator Gen;
+    CHECK(Gen.Initialize(Blocks[0], Selector));
+    CHECK(Selector->GetName() == elParser().GetName());
+    Gen.ParseBlock(Blocks[0]);
+    Gen.ParseBlock(Blocks[1]);
+    CHECK(Gen.GetParsedFrameCount() == 6);
+    return;
+}
+
+static void TestParserFallbackWithoutRunnerUp()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(2);
+    shared_ptr<elParserSelector> Selector = make_shared<elParserSelector>();
+    Selector->SelectorListAdd(make_shared<elTestFailingParser>());
+
+    elMpegGenerator Gen;
+    CHECK(!Gen.Initialize(Blocks[0], Selector));
+    return;
+}
+
+static void TestFrameArena()
+{
+    // 1000 byte frames, so that 65 of them fill a chunk and the next one has to skip ahead
+    elFrameArena Arena;
+    std::vector<unsigned long> Offsets;
+    for (unsigned int i = 0; i < 200; i++)
+    {
+        const unsigned long Offset = Arena.Begin(1000);
+        CHECK(Offset % FRAME_ARENA_CHUNK_SIZE + 1000 <= FRAME_ARENA_CHUNK_SIZE);
+        memset(Arena.Get(Offset), i, 1000);
+        Arena.Commit(Offset, 1000);
+        Offsets.push_back(Offset);
+    }
+    CHECK(Arena.GetEnd() == Offsets.back() + 1000);
+
+    for (unsigned int i = 0; i < Offsets.size(); i++)
+    {
+        const uint8_t* Data = Arena.Get(Offsets[i]);
+        CHECK(Data[0] == (uint8_t)i && Data[999] == (uint8_t)i);
+    }
+    return;
+}
+
+static void TestFrameArenaDiscard()
+{
+    elFrameArena Arena;
+    std::vector<unsigned long> Offsets;
+    for (unsigned int i = 0; i < 200; i++)
+    {
+        // Only keep part of what was asked for, like a frame that came out smaller
+        const unsigned long Offset = Arena.Begin(MAX_MPEG_FRAME_BUFFER);
+        memset(Arena.Get(Offset), i, 500);
+        Arena.Commit(Offset, 500);
+        Offsets.push_back(Offset);
+    }
+
+    // The chunks before frame 150 go, and the offsets of the rest still work
+    Arena.Discard(Offsets[150]);
+    for (unsigned int i = 150; i < Offsets.size(); i++)
+    {
+        CHECK(Arena.Get(Offsets[i])[499] == (uint8_t)i);
+    }
+
+    const unsigned long Offset = Arena.Begin(500);
+    CHECK(Offset == Offsets.back() + 500);
+    Arena.Discard(Arena.GetEnd());
+    CHECK(Arena.Get(Offsets.back())[0] == 199);
+    return;
+}
+
+static void TestGranulesPointIntoBlock()
+{
+    std::vector<uint8_t> Bytes;
+    AppendTestFrames(Bytes, 0, 3);
+    const elBlock Block = MakeTestBlock(Bytes, 3 * 1152);
+
+    elParser Parser;
+    elStreamVector Streams;
+    bsBitstream IS(Block.Data.get(), Block.Size);
+    Parser.Parse(Streams, IS, Block.Data);
+    CheckTestFrames(Streams[0], 0, 3);
+
+    // The main data isn't copied, the granules point at it in the block
+    for (unsigned int i = 0; i < Streams[0].size(); i++)
+    {
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            const elGranule& Gr = Streams[0][i].Gr[j];
+            CHECK(Gr.Data == Block.Data);
+            CHECK(Gr.DataSizeBits == 256);
+            CHECK((Gr.DataOffset + Gr.DataSizeBits + 7) / 8 <= Block.Size);
+            CHECK(bsBitReader(Block.Data.get(), Block.Size, Gr.DataOffset).ReadBits(8) == (uint8_t)(i * 31));
+        }
+    }
+    return;
+}
+
+static void TestGranulesKeepBlockAlive()
+{
+    std::vector<uint8_t> Bytes;
+    AppendTestFrames(Bytes, 0, 1);
+    elBlock Block = MakeTestBlock(Bytes, 1152);
+    const uint8_t* Data = Block.Data.get();
+
+    elParser Parser;
+    elStreamVector Streams;
+    {
+        bsBitstream IS(Block.Data.get(), Block.Size);
+        Parser.Parse(Streams, IS, Block.Data);
+    }
+
+    // Once the block is gone, the granules are the only thing holding on to its buffer
+    Block.Data.reset();
+    CHECK(Streams[0][0].Gr[0].Data.get() == Data);
+    CHECK(Streams[0][0].Gr[0].Data.use_count() == 2);
+    CHECK(bsBitReader(Data, Bytes.size(), Streams[0][0].Gr[1].DataOffset + 8).ReadBits(8) == 1);
+    return;
+}
+
+/// A small random number generator, so that the bit tests are the same on every run.
+static unsigned int NextTestRandom(unsigned int& State)
+{
+    State = State * 1103515245 + 12345;
+    return State >> 8;
+}
+
+static std::vector<uint8_t> MakeRandomBytes(unsigned int Size, unsigned int Seed)
+{
+    std::vector<uint8_t> Bytes(Size);
+    for (unsigned int i = 0; i < Size; i++)
+    {
+        Bytes[i] = (uint8_t)NextTestRandom(Seed);
+    }
+    return Bytes;
+}
+
+static void TestBitReaderMatchesBitstream()
+{
+    std::vector<uint8_t> Bytes = MakeRandomBytes(4096, 4);
+    unsigned int Seed = 1;
+
+    // Fields of 1 to 32 bits, starting on and off a byte boundary
+    for (unsigned int Start = 0; Start < 16; Start += 3)
+    {
+        bsBitstream IS(&Bytes[0], Bytes.size());
+        IS.SeekAbsolute(Start);
+        bsBitReader Reader(&Bytes[0], Bytes.size(), Start);
+
+        while (IS.GetCountBitsLeft() >= 32)
+        {
+            const unsigned int Count = NextTestRandom(Seed) % 32 + 1;
+            const unsigned int Peeked = Reader.PeekBits(Count);
+            const unsigned int Expected = IS.ReadBits(Count);
+            CHECK(Peeked == Expected);
+            CHECK(Reader.ReadBits(Count) == Expected);
+            CHECK(Reader.Tell() == IS.Tell());
+        }
+    }
+    return;
+}
+
+static void TestBitReaderPastTheEnd()
+{
+    // Less than a cache load, and the bits past the end read as zero
+    const uint8_t Bytes[3] = {0xAB, 0xCD, 0xEF};
+    bsBitReader Reader(Bytes, sizeof(Bytes), 4);
+    CHECK(Reader.GetCountBitsLeft() == 20);
+    CHECK(Reader.ReadBits(12) == 0xBCD);
+    CHECK(Reader.ReadBits(16) == 0xEF00);
+    CHECK(Reader.GetCountBitsLeft() == 0);
+    CHECK(Reader.Tell() == 32);
+
+    Reader.SeekAbsolute(7);
+    Reader.SkipBits(9);
+    CHECK(Reader.ReadBits(8) == 0xEF);
+    return;
+}
+
+static void TestBitWriterMatchesBitstream()
+{
+    const std::vector<uint8_t> Background = MakeRandomBytes(1024, 5);
+    unsigned int Seed = 2;
+
+    for (unsigned int Start = 0; Start < 16; Start += 5)
+    {
+        std::vector<uint8_t> Expected(Background);
+        std::vector<uint8_t> Written(Background);
+        bsBitstream OS(&Expected[0], Expected.size());
+        OS.SeekAbsolute(Start);
+        bsBitWriter Writer(&Written[0], Written.size(), Start);
+
+        // Fields of 0 to 32 bits, with junk above the bits that are written
+        while (OS.GetCountBitsLeft() >= 64)
+        {
+            const unsigned int Count = NextTestRandom(Seed) % 33;
+            const unsigned int Bits = NextTestRandom(Seed) | (Seed << 24);
+            OS.WriteBits(Bits, Count);
+            Writer.WriteBits(Bits, Count);
+        }
+        Writer.Flush();
+        CHECK(Writer.Tell() == OS.Tell());
+        CHECK(Written == Expected);
+    }
+    return;
+}
+
+static void TestBitWriterKeepsSurroundingBits()
+{
+    std::vector<uint8_t> Bytes(8, 0xFF);
+    bsBitWriter Writer(&Bytes[0], Bytes.size(), 3);
+    Writer.WriteBits(0, 10);
+    Writer.Flush();
+    CHECK(Bytes[0] == 0xE0 && Bytes[1] == 0x07 && Bytes[2] == 0xFF);
+
+    // Writing carries on after a flush, and a copy in the middle lines back up
+    const uint8_t Src[2] = {0x5A, 0xC3};
+    Writer.CopyBits(Src, 4, 8);
+    Writer.WriteToNextByte();
+    Writer.Flush();
+    CHECK(Writer.Tell() == 24);
+    CHECK(Bytes[1] == 0x05 && Bytes[2] == 0x60 && Bytes[3] == 0xFF);
+    return;
+}
+
+/// Copy one bit at a time, to check bsCopyBits() against.
+static void CopyTestBits(std::vector<uint8_t>& Dst, unsigned long DstBitOffset,
+    const std::vector<uint8_t>& Src, unsigned long SrcBitOffset, unsigned long Count)
+{
+    for (unsigned long i = 0; i < Count; i++)
+    {
+        const unsigned long From = SrcBitOffset + i;
+        const unsigned long To = DstBitOffset + i;
+        const unsigned int Bit = (Src[From / 8] >> (7 - From % 8)) & 1;
+        Dst[To / 8] = uint8_t((Dst[To / 8] & ~(0x80 >> To % 8)) | (Bit << (7 - To % 8)));
+    }
+    return;
+}
+
+static void TestCopyBitsMatchesBitByBit()
+{
+    const std::vector<uint8_t> Src = MakeRandomBytes(256, 6);
+    const std::vector<uint8_t> Background = MakeRandomBytes(256, 7);
+    const unsigned long Counts[] = {1, 7, 8, 9, 63, 64, 65, 200, 1500};
+
+    for (unsigned int SrcOffset = 0; SrcOffset < 8; SrcOffset++)
+    {
+        for (unsigned int DstOffset = 0; DstOffset < 8; DstOffset++)
+        {
+            for (unsigned int i = 0; i < sizeof(Counts) / sizeof(Counts[0]); i++)
+            {
+                std::vector<uint8_t> Expected(Background);
+                std::vector<uint8_t> Copied(Background);
+                CopyTestBits(Expected, 16 + DstOffset, Src, 24 + SrcOffset, Counts[i]);
+                bsCopyBits(&Copied[0], 16 + DstOffset, &Src[0], 24 + SrcOffset, Counts[i]);
+                CHECK(Copied == Expected);
+            }
+        }
+    }
+    return;
+}
+
+static void TestCopyBitsEdges()
+{
+    // Nothing is touched for 0 bits, and a single bit keeps the rest of its byte
+    std::vector<uint8_t> Dst(4, 0x55);
+    const std::vector<uint8_t> Src(4, 0xFF);
+    bsCopyBits(&Dst[0], 3, &Src[0], 5, 0);
+    CHECK(Dst == std::vector<uint8_t>(4, 0x55));
+    bsCopyBits(&Dst[0], 8, &Src[0], 7, 1);
+    CHECK(Dst[0] == 0x55 && Dst[1] == 0xD5 && Dst[2] == 0x55);
+
+    // The source ends on the last bit, so nothing after it may be read
+    std::vector<uint8_t> Tail = MakeRandomBytes(3, 8);
+    std::vector<uint8_t> Expected(4, 0);
+    std::vector<uint8_t> Copied(4, 0);
+    CopyTestBits(Expected, 6, Tail, 5, 19);
+    bsCopyBits(&Copied[0], 6, &Tail[0], 5, 19);
+    CHECK(Copied == Expected);
+    return;
+}
+
+/// Write Bytes to a file in the working directory and return its name.
+static std::string WriteTestFile(const std::vector<uint8_t>& Bytes)
+{
+    const std::string Filename = "ealayer3-selftest.tmp";
+    std::ofstream Output(Filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+    if (!Bytes.empty())
+    {
+        Output.write((const char*)&Bytes[0], Bytes.size());
+    }
+    return Filename;
+}
+
+static void TestMappedInputStream()
+{
+    const std::vector<uint8_t> Bytes = MakeRandomBytes(10000, 9);
+    const std::string Filename = WriteTestFile(Bytes);
+
+    elMappedInputStream Input;
+    CHECK(Input.Open(Filename));
+    std::vector<uint8_t> Read(Bytes.size());
+    Input.read((char*)&Read[0], 100);
+    Input.seekg(5000);
+    Input.read((char*)&Read[5000], 5000);
+    Input.seekg(-9900, std::ios_base::cur);
+    Input.read((char*)&Read[100], 4900);
+    CHECK(Input.good() && Read == Bytes);
+
+    // Shared bytes point into the mapping and outlive the stream
+    shared_array<uint8_t> Shared = Input.Share(9000, 1000);
+    CHECK(Shared && memcmp(Shared.get(), &Bytes[9000], 1000) == 0);
+    Input.Close();
+    CHECK(!Input.IsOpen() && Shared[999] == Bytes[9999]);
+    std::remove(Filename.c_str());
+    return;
+}
+
+static void TestMappedInputStreamEdges()
+{
+    const std::vector<uint8_t> Bytes = MakeRandomBytes(100, 10);
+    const std::string Filename = WriteTestFile(Bytes);
+
+    elMappedInputStream Input;
+    CHECK(Input.Open(Filename));
+    CHECK(!Input.Share(50, 51) && !Input.Share(-1, 1) && Input.Share(100, 0));
+
+    // Past the end the position is kept, but the reads come up empty
+    Input.seekg(150);
+    CHECK(Input.tellg() == std::streampos(150));
+    char Byte;
+    Input.read(&Byte, 1);
+    CHECK(Input.eof() && Input.gcount() == 0);
+    Input.Close();
+
+    // An empty file isn't mapped
+    WriteTestFile(std::vector<uint8_t>());
+    CHECK(!Input.Open(Filename));
+    std::remove(Filename.c_str());
+    return;
+}
+
+/// Append an SCx chunk with its 8 byte header to Bytes.
+static void AppendScxChunk(std::string& Bytes, const char* Type, const std::string& Payload)
+{
+    const uint32_t Size = Payload.size() + 8;
+    Bytes.append(Type, 4);
+    Bytes.append((const char*)&Size, 4);
+    Bytes += Payload;
+    return;
+}
+
+/// Make an SCDl payload of SampleCount samples and DataSize bytes filled with Fill.
+static std::string MakeScxData(uint32_t SampleCount, unsigned int DataSize, char Fill)
+{
+    std::string Payload(12, '\0');
+    Swap(SampleCount);
+    memcpy(&Payload[0], &SampleCount, 4);
+    return Payload + std::string(DataSize, Fill);
+}
+
+/// The start of a PT file: a split header and the block count.
+static std::string MakeScxHeader()
+{
+    std::string Bytes;
+    const char Header[] = {'P', 'T', 0, 0, (char)0xFD, (char)0x80, 1, 1, (char)0xA0, 1, 0x17, (char)0xFF};
+    AppendScxChunk(Bytes, "SCHl", std::string(Header, sizeof(Header)));
+    AppendScxChunk(Bytes, "SCCl", std::string("\0\0\0\x02", 4));
+    return Bytes;
+}
+
+static void TestScxLoaderSkipsChunks()
+{
+    // Plenty of chunks to skip between the blocks, more than a recursive skip would survive
+    std::string Bytes = MakeScxHeader();
+    for (unsigned int i = 0; i < 100000; i++)
+    {
+        AppendScxChunk(Bytes, "SCLl", std::string(4, 'x'));
+    }
+    const std::streamoff FirstOffset = Bytes.size();
+    AppendScxChunk(Bytes, "SCDl", MakeScxData(1152, 100, 'a'));
+    AppendScxChunk(Bytes, "SCLl", std::string(4, 'x'));
+    const std::streamoff SecondOffset = Bytes.size();
+    AppendScxChunk(Bytes, "SCDl", MakeScxData(576, 50, 'b'));
+    AppendScxChunk(Bytes, "SCEl", std::string(4, '\0'));
+
+    std::stringstream Input(Bytes);
+    elAsfPtLoader Loader;
+    CHECK(Loader.Sniff((const uint8_t*)Bytes.data(), LOADER_SNIFF_SIZE, 0));
+    CHECK(Loader.Initialize(&Input));
+
+    elBlock Block;
+    CHECK(Loader.ReadNextBlock(Block));
+    CHECK(Block.Offset == FirstOffset && Block.SampleCount == 1152 && Block.Size == 100);
+    CHECK(Block.Data[0] == 'a' && Block.Data[99] == 'a');
+    CHECK(Loader.ReadNextBlock(Block));
+    CHECK(Block.Offset == SecondOffset && Block.SampleCount == 576 && Block.Size == 50);
+    CHECK(Block.Data[49] == 'b');
+    CHECK(!Loader.ReadNextBlock(Block));
+    return;
+}
+
+static void TestScxLoaderTruncatedBlock()
+{
+    // The last block says it is bigger than what is left of the input
+    std::string Bytes = MakeScxHeader();
+    AppendScxChunk(Bytes, "SCDl", MakeScxData(1152, 100, 'a'));
+    std::string Truncated;
+    AppendScxChunk(Truncated, "SCDl", MakeScxData(1152, 100000, 'b'));
+    Bytes += Truncated.substr(0, 200);
+
+    std::stringstream Input(Bytes);
+    elAsfPtLoader Loader;
+    CHECK(Loader.Initialize(&Input));
+    elBlock Block;
+    CHECK(Loader.ReadNextBlock(Block) && Block.Size == 100);
+    CHECK(!Loader.ReadNextBlock(Block));
+    CHECK(!Loader.ReadNextBlock(Block));
+    return;
+}
+
+/// Write Blocks to Filename as a headerless file.
+static void WriteHeaderlessTestFile(const std::string& Filename, const std::vector<elBlock>& Blocks)
+{
+    std::ofstream Output(Filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+    elHeaderlessWriter Writer;
+    Writer.Initialize(&Output);
+    for (unsigned int i = 0; i < Blocks.size(); i++)
+    {
+        Writer.WriteNextBlock(Blocks[i], i + 1 == Blocks.size());
+    }
+    return;
+}
+
+static std::vector<uint8_t> ReadTestFile(const std::string& Filename)
+{
+    std::ifstream Input(Filename.c_str(), std::ios_base::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(Input)), std::istreambuf_iterator<char>());
+}
+
+/// Decode the inputs in Directory to MP3 on Threads threads, returning the number of failures.
+static unsigned int DecodeTestBatch(const std::string& Directory, unsigned int Threads)
+{
+    elFileDecoder Settings;
+    Settings.SetParser(elFileDecoder::P_VERSION5);
+    Settings.SetOutput("", elFileDecoder::F_MP3);
+
+    elBatchDecoder Batch(Settings);
+    Batch.AddInput(Directory);
+    Batch.SetThreads(Threads);
+    return Batch.Process();
+}
+
+static void TestBatchDecoder()
+{
+    const std::string Directory = "ealayer3-selftest-batch";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+
+    // Files of different lengths, so that the threads finish them out of order
+    const unsigned int Count = 6;
+    for (unsigned int i = 0; i < Count; i++)
+    {
+        WriteHeaderlessTestFile((format("%s/%i.bin") % Directory % i).str(), MakeSplitFrameFile(i * 3 + 1));
+    }
+    CHECK(DecodeTestBatch(Directory, 3) == 0);
+
+    for (unsigned int i = 0; i < Count; i++)
+    {
+        const std::string Output = (format("%s/%i.mp3") % Directory % i).str();
+        CHECK(ReadTestFile(Output) == MakeTestMp3(MakeSplitFrameFile(i * 3 + 1), 0));
+    }
+
+    // The outputs aren't picked up as inputs the next time around
+    elBatchDecoder Batch((elFileDecoder()));
+    Batch.AddInput(Directory);
+    CHECK(Batch.GetInputCount() == Count);
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+static void TestBatchDecoderFailure()
+{
+    const std::string Directory = "ealayer3-selftest-batch";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+
+    // A file that no loader takes doesn't stop the one after it, even on one thread
+    std::ofstream((Directory + "/0.bin").c_str()) << "Not an EA Layer 3 file";
+    WriteHeaderlessTestFile(Directory + "/1.bin", MakeSplitFrameFile(2));
+    CHECK(DecodeTestBatch(Directory, 1) == 1);
+    CHECK(ReadTestFile(Directory + "/1.mp3") == MakeTestMp3(MakeSplitFrameFile(2), 0));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+static void TestParallelStreamOutputs()
+{
+    const std::string Directory = "ealayer3-selftest-streams";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+
+    // Three streams in every block
+    std::vector<elBlock> Blocks;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        std::vector<uint8_t> Bytes;
+        AppendTestFrames(Bytes, i * 4, i * 4 + 4, 3);
+        Blocks.push_back(MakeTestBlock(Bytes, 4 * 1152));
+    }
+    WriteHeaderlessTestFile(Directory + "/in.bin", Blocks);
+
+    elFileDecoder Decoder;
+    Decoder.SetInput(Directory + "/in.bin");
+    Decoder.SetParser(elFileDecoder::P_VERSION5);
+    Decoder.SetOutput("", elFileDecoder::F_MP3);
+    Decoder.Process();
+
+    // Each stream goes to its own file, whichever thread finishes first
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const std::vector<uint8_t> Output = ReadTestFile((format("%s/in_%i.mp3") % Directory % (i + 1)).str());
+        CHECK(!Output.empty() && Output == MakeTestMp3(Blocks, 0, i));
+    }
+    CHECK(MakeTestMp3(Blocks, 0, 0) != MakeTestMp3(Blocks, 0, 2));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+/// Push Count numbers into Queue, closing it when done.
+static void PushTestItems(elBoundedQueue<unsigned int>& Queue, unsigned int Count)
+{
+    for (unsigned int i = 0; i < Count && Queue.Push(i); i++)
+    {
+    }
+    Queue.Close();
+    return;
+}
+
+static void TestBoundedQueue()
+{
+    // The producer is held back by the capacity, but everything gets through in order
+    elBoundedQueue<unsigned int> Queue(2);
+    boost::thread Producer(boost::bind(&PushTestItems, boost::ref(Queue), 1000));
+    unsigned int Item;
+    unsigned int Count = 0;
+    while (Queue.Pop(Item))
+    {
+        CHECK(Item == Count);
+        Count++;
+    }
+    Producer.join();
+    CHECK(Count == 1000);
+
+    // Closing the queue from the consumer's side lets a waiting producer give up
+    elBoundedQueue<unsigned int> Abandoned(2);
+    boost::thread Waiting(boost::bind(&PushTestItems, boost::ref(Abandoned), 1000));
+    CHECK(Abandoned.Pop(Item) && Item == 0);
+    Abandoned.Close();
+    Waiting.join();
+    return;
+}
+
+/// Get the MP3 file that the pipeline makes from the blocks, through a writer stage if LookAhead isn't 0.
+static std::vector<uint8_t> MakePipelineTestMp3(const std::vector<elBlock>& Blocks, unsigned int LookAhead, unsigned int Threads)
+{
+    elTestBlockLoader Loader(Blocks);
+    elBlock FirstBlock;
+    Loader.ReadNextBlock(FirstBlock);
+
+    elMpegGenerator Gen;
+    elTestFrameSink Sink;
+    CHECK(Gen.Initialize(FirstBlock, make_shared<elParser>()));
+    elDecodePipeline Pipeline(Loader, Gen);
+    Pipeline.SetParserThreads(Threads);
+    if (LookAhead)
+    {
+        Gen.SetStreaming(Pipeline.CreateWriter(&Sink), LookAhead);
+    }
+    Pipeline.Run(FirstBlock);
+    if (LookAhead)
+    {
+        return Sink.Bytes;
+    }
+
+    uint8_t Buffer[MAX_MPEG_FRAME_BUFFER];
+    for (unsigned int i = 0; i < Gen.GetFrameCount(); i++)
+    {
+        const unsigned int Size = Gen.ReadFrame(Buffer, sizeof(Buffer), i);
+        Sink.Bytes.insert(Sink.Bytes.end(), Buffer, Buffer + Size);
+    }
+    return Sink.Bytes;
+}
+
+static void TestPipelineMatchesSerial()
+{
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(20);
+    const std::vector<uint8_t> Serial = MakeTestMp3(Blocks, 0);
+    CHECK(!Serial.empty());
+    CHECK(MakePipelineTestMp3(Blocks, 0, 1) == Serial);
+    CHECK(MakePipelineTestMp3(Blocks, 0, 4) == Serial);
+    return;
+}
+
+static void TestPipelineWriterStage()
+{
+    // Borrowing frames make the generator hold frames back while the writer has some
+    const std::vector<elBlock> Blocks = MakeBorrowingFile(40);
+    const std::vector<uint8_t> Serial = MakeTestMp3(Blocks, 4);
+    CHECK(Serial == MakeTestMp3(Blocks, 0));
+    CHECK(MakePipelineTestMp3(Blocks, 4, 1) == Serial);
+    CHECK(MakePipelineTestMp3(Blocks, 4, 3) == Serial);
+
+    // A single block goes through every stage too
+    const std::vector<elBlock> One(1, Blocks[0]);
+    CHECK(MakePipelineTestMp3(One, 4, 1) == MakeTestMp3(One, 0));
+    return;
+}
+
+/// An elParser that counts how often it has been probed.
+class elTestCountingParser : public elParser
+{
+public:
+    elTestCountingParser() :
+        m_Probes(0)
+    {
+        return;
+    }
+
+    virtual unsigned int Probe(bsBitstream& IS, unsigned int MaxGranules)
+    {
+        m_Probes++;
+        return elParser::Probe(IS, MaxGranules);
+    }
+
+    unsigned int m_Probes;
+};
+
+static void TestParserProbe()
+{
+    // Start the probe at the second frame
+    std::vector<uint8_t> Bytes;
+    AppendTestFrames(Bytes, 0, 1);
+    const unsigned long Start = Bytes.size() * 8;
+    AppendTestFrames(Bytes, 1, 8);
+    bsBitstream IS(&Bytes[0], Bytes.size());
+    IS.SeekAbsolute(Start);
+
+    // The version 6 parser can't read these, and the stream is left where it was
+    elParserSelector Selector;
+    Selector.SelectorListAdd(make_shared<elParserVersion6>());
+    Selector.SelectorListAdd(make_shared<elParser>());
+    CHECK(Selector.Probe(IS, 8) == 8);
+    CHECK(Selector.GetName() == elParser().GetName());
+    CHECK(IS.Tell() == Start);
+    return;
+}
+
+static void TestParserProbeStopsEarly()
+{
+    std::vector<uint8_t> Bytes;
+    AppendTestFrames(Bytes, 0, 2);
+    bsBitstream IS(&Bytes[0], Bytes.size());
+
+    // The block ends before the probe does, which still counts as a full score
+    shared_ptr<elTestCountingParser> First = make_shared<elTestCountingParser>();
+    shared_ptr<elTestCountingParser> Last = make_shared<elTestCountingParser>();
+    elParserSelector Selector;
+    Selector.SelectorListAdd(First);
+    Selector.SelectorListAdd(make_shared<elParser>());
+    Selector.SelectorListAdd(Last);
+    CHECK(Selector.Probe(IS, 4) == 4);
+    CHECK(Selector.Probe(IS, 8) == 4);
+
+    // Once two parsers have read all 4 granules the last one isn't tried
+    CHECK(First->m_Probes == 2 && Last->m_Probes == 1);
+    CHECK(Selector.GetName() == First->GetName());
+    return;
+}
+
+/**
+ * Get the name of the loader that elBlockLoaderSelector picks for Bytes, or "" if none does.
+ * The first block should be SampleCount sample frames long.
+ */
+static std::string SelectTestLoader(const std::string& Bytes, unsigned int SampleCount)
+{
+    std::stringstream Input(Bytes);
+    elBlockLoaderSelector Selector;
+    if (!Selector.Initialize(&Input))
+    {
+        return "";
+    }
+
+    // The loader starts from the start of the input, whatever the others read of it
+    elBlock Block;
+    CHECK(Selector.ReadNextBlock(Block) && Block.SampleCount == SampleCount);
+    return Selector.GetName();
+}
+
+static std::string MakeHeaderlessTestBytes(const std::vector<elBlock>& Blocks)
+{
+    std::stringstream Output;
+    elHeaderlessWriter Writer;
+    Writer.Initialize(&Output);
+    for (unsigned int i = 0; i < Blocks.size(); i++)
+    {
+        Writer.WriteNextBlock(Blocks[i], i + 1 == Blocks.size());
+    }
+    return Output.str();
+}
+
+static void TestLoaderSelection()
+{
+    std::string Scx = MakeScxHeader();
+    AppendScxChunk(Scx, "SCDl", MakeScxData(1152, 100, 'a'));
+    AppendScxChunk(Scx, "SCEl", std::string(4, '\0'));
+    const std::string Headerless = MakeHeaderlessTestBytes(MakeSplitFrameFile(4));
+
+    // Each input goes to the loader that can read it, and the loaders that sniffed it
+    // out wouldn't have initialized with it either
+    CHECK(SelectTestLoader(Scx, 1152) == elAsfPtLoader().GetName());
+    CHECK(SelectTestLoader(Headerless, 5 * 576) == elHeaderlessLoader().GetName());
+
+    const std::string Inputs[] = {Scx, Headerless};
+    elBlockLoaderSelector Selector;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        for (elBlockLoaderSelector::fsFormatList::iterator Iter = Selector.SelectorList().begin();
+            Iter != Selector.SelectorList().end(); ++Iter)
+        {
+            std::stringstream Input(Inputs[i]);
+            if (!(*Iter)->Sniff((const uint8_t*)Inputs[i].data(), LOADER_SNIFF_SIZE, 0))
+            {
+                CHECK(!(*Iter)->Initialize(&Input));
+            }
+        }
+    }
+    return;
+}
+
+static void TestLoaderSelectionShortInput()
+{
+    // One small block makes a file shorter than what the selector sniffs
+    const std::vector<uint8_t> Bytes(20, 0x55);
+    const std::string Headerless = MakeHeaderlessTestBytes(std::vector<elBlock>(1, MakeTestBlock(Bytes, 1152)));
+    CHECK(Headerless.size() < LOADER_SNIFF_SIZE);
+    CHECK(SelectTestLoader(Headerless, 1152) == elHeaderlessLoader().GetName());
+
+    // Short and no good for anything
+    std::stringstream Input(std::string(10, 0x12));
+    CHECK(!elBlockLoaderSelector().Initialize(&Input));
+    return;
+}
+
+/// Run Decoder with std::cout going into Output, as if stdout was redirected.
+static void ProcessToTestStdout(elFileDecoder& Decoder, std::stringstream& Output)
+{
+    std::streambuf* Previous = std::cout.rdbuf(Output.rdbuf());
+    try
+    {
+        Decoder.Process();
+    }
+    catch (...)
+    {
+        std::cout.rdbuf(Previous);
+        throw;
+    }
+    std::cout.rdbuf(Previous);
+    return;
+}
+
+static void TestStdoutOutput()
+{
+    const std::string Directory = "ealayer3-selftest-stdout";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(6);
+    WriteHeaderlessTestFile(Directory + "/in.bin", Blocks);
+
+    elFileDecoder Decoder;
+    Decoder.SetInput(Directory + "/in.bin");
+    Decoder.SetParser(elFileDecoder::P_VERSION5);
+    Decoder.SetOutput(elFileDecoder::STDOUT_FILENAME, elFileDecoder::F_MP3);
+    std::stringstream Output;
+    ProcessToTestStdout(Decoder, Output);
+
+    // Only the MP3 goes to stdout, and no file is written for it
+    const std::string Bytes = Output.str();
+    const std::vector<uint8_t> Expected = MakeTestMp3(Blocks, 0);
+    CHECK(std::vector<uint8_t>(Bytes.begin(), Bytes.end()) == Expected);
+    CHECK(!boost::filesystem::exists(Directory + "/in.mp3"));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+static void TestStdoutOutputManyStreams()
+{
+    const std::string Directory = "ealayer3-selftest-stdout";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+    std::vector<uint8_t> Bytes;
+    AppendTestFrames(Bytes, 0, 4, 2);
+    WriteHeaderlessTestFile(Directory + "/in.bin", std::vector<elBlock>(1, MakeTestBlock(Bytes, 4 * 1152)));
+
+    // Two streams can't share stdout, and std::cout is back to normal after the error
+    elFileDecoder Decoder;
+    Decoder.SetInput(Directory + "/in.bin");
+    Decoder.SetParser(elFileDecoder::P_VERSION5);
+    Decoder.SetOutput(elFileDecoder::STDOUT_FILENAME, elFileDecoder::F_MP3);
+    std::streambuf* Previous = std::cout.rdbuf();
+    std::stringstream Output;
+    bool Threw = false;
+    try
+    {
+        ProcessToTestStdout(Decoder, Output);
+    }
+    catch (std::runtime_error&)
+    {
+        Threw = true;
+    }
+    CHECK(Threw && Output.str().empty());
+    CHECK(std::cout.rdbuf() == Previous);
+
+    // Picking one of them works
+    Decoder.SetStream(1);
+    ProcessToTestStdout(Decoder, Output);
+    const std::string Written = Output.str();
+    CHECK(std::vector<uint8_t>(Written.begin(), Written.end()) ==
+        MakeTestMp3(std::vector<elBlock>(1, MakeTestBlock(Bytes, 4 * 1152)), 0, 1));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+/// Run Decoder with std::cin reading Input, as if it was piped in.
+static void ProcessFromTestStdin(elFileDecoder& Decoder, const std::string& Input)
+{
+    std::stringbuf Buffer(Input);
+    std::streambuf* Previous = std::cin.rdbuf(&Buffer);
+    try
+    {
+        Decoder.Process();
+    }
+    catch (...)
+    {
+        std::cin.rdbuf(Previous);
+        throw;
+    }
+    std::cin.rdbuf(Previous);
+    return;
+}
+
+static void TestStdinInput()
+{
+    const std::string Directory = "ealayer3-selftest-stdin";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(6);
+
+    // The loaders are picked from the start of the pipe, which is read only once
+    elFileDecoder Decoder;
+    Decoder.SetInput(elFileDecoder::STDIN_FILENAME);
+    Decoder.SetParser(elFileDecoder::P_VERSION5);
+    Decoder.SetOutput(Directory + "/out.mp3", elFileDecoder::F_MP3);
+    CHECK(Decoder.ReadsFromStdin());
+    ProcessFromTestStdin(Decoder, MakeHeaderlessTestBytes(Blocks));
+    CHECK(ReadTestFile(Directory + "/out.mp3") == MakeTestMp3(Blocks, 0));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+static void TestStdinInputParts()
+{
+    const std::string Directory = "ealayer3-selftest-stdin";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+    const std::vector<elBlock> First = MakeSplitFrameFile(2);
+    const std::vector<elBlock> Second = MakeSplitFrameFile(5);
+
+    // Without a size to go by, the parts carry on until the pipe runs dry
+    elFileDecoder Decoder;
+    Decoder.SetInput(elFileDecoder::STDIN_FILENAME);
+    Decoder.SetParser(elFileDecoder::P_VERSION5);
+    Decoder.SetOutput(Directory + "/out.mp3", elFileDecoder::F_MP3);
+    ProcessFromTestStdin(Decoder, MakeHeaderlessTestBytes(First) + MakeHeaderlessTestBytes(Second));
+    CHECK(ReadTestFile(Directory + "/out.mp3") == MakeTestMp3(First, 0));
+    CHECK(ReadTestFile(Directory + "/out_part2.mp3") == MakeTestMp3(Second, 0));
+    CHECK(!boost::filesystem::exists(Directory + "/out_part3.mp3"));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+static void TestReadFramesMatchesReadFrame()
+{
+    // Borrowing frames come out in different sizes
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, MakeBorrowingFile(30));
+    const std::vector<uint8_t> Expected = MakeTestMp3(MakeBorrowingFile(30), 0);
+
+    // Runs of 7 frames, or fewer when the buffer fills up first
+    const unsigned int BufferSizes[] = {MAX_MPEG_FRAME_BUFFER, 3000, 100000};
+    for (unsigned int i = 0; i < sizeof(BufferSizes) / sizeof(BufferSizes[0]); i++)
+    {
+        std::vector<uint8_t> Buffer(BufferSizes[i]);
+        std::vector<uint8_t> Read;
+        unsigned int Index = 0;
+        while (Index < Gen.GetFrameCount())
+        {
+            unsigned int Count = 7;
+            const unsigned int Size = Gen.ReadFrames(&Buffer[0], Buffer.size(), Index, Count);
+            CHECK(Count > 0 && Count <= 7 && Size <= Buffer.size());
+            if (!Count)
+            {
+                break;
+            }
+            Read.insert(Read.end(), Buffer.begin(), Buffer.begin() + Size);
+            Index += Count;
+        }
+        CHECK(Read == Expected);
+    }
+    return;
+}
+
+static void TestReadFramesPastTheEnd()
+{
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, MakeSplitFrameFile(2));
+    const unsigned int Last = Gen.GetFrameCount() - 1;
+
+    // Asking for more than is left gives what is left, and nothing at the end
+    uint8_t Buffer[MAX_MPEG_FRAME_BUFFER * 8];
+    uint8_t Frame[MAX_MPEG_FRAME_BUFFER];
+    unsigned int Count = 100;
+    const unsigned int Size = Gen.ReadFrames(Buffer, sizeof(Buffer), Last - 1, Count);
+    const unsigned int NextToLast = Gen.ReadFrame(Frame, sizeof(Frame), Last - 1);
+    CHECK(Count == 2 && Size == NextToLast + Gen.ReadFrame(Frame, sizeof(Frame), Last));
+    Count = 3;
+    CHECK(Gen.ReadFrames(Buffer, sizeof(Buffer), Last + 1, Count) == 0 && Count == 0);
+
+    // A buffer too small for the next frame takes none of them
+    Count = 3;
+    CHECK(Gen.ReadFrames(Buffer, NextToLast - 1, Last - 1, Count) == 0 && Count == 0);
+    return;
+}
+
+/// Decode frames First to End of the generator's first stream with Warmup frames before them.
+static std::vector<short> ReadTestPcmSegment(const elMpegGenerator& Gen, unsigned int First, unsigned int End, unsigned int Warmup)
+{
+    std::vector<short> Samples;
+    std::vector<short> Buffer(1000);
+    shared_ptr<elPcmOutputStream> Stream = Gen.CreatePcmStream(0);
+    Stream->SetFrameRange(First, End, Warmup);
+    while (!Stream->Eos())
+    {
+        const unsigned int Count = Stream->Read(&Buffer[0], Buffer.size());
+        Samples.insert(Samples.end(), Buffer.begin(), Buffer.begin() + Count);
+    }
+    return Samples;
+}
+
+static void TestPcmSegments()
+{
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, MakeSplitFrameFile(10));
+    const std::vector<short> Whole = ReadTestPcm(Gen, 4096);
+    CHECK(!Whole.empty());
+
+    // The segments put back together and cut to length are the whole stream
+    std::vector<short> Joined;
+    for (unsigned int First = 0; First < Gen.GetFrameCount(); First += 7)
+    {
+        const std::vector<short> Segment = ReadTestPcmSegment(Gen, First, First + 7, 8);
+
+        // The info frame at the start doesn't make any samples
+        const unsigned int End = min(First + 7, Gen.GetFrameCount());
+        CHECK(Segment.size() == (End - std::max(First, 1u)) * 1152 * 2);
+        Joined.insert(Joined.end(), Segment.begin(), Segment.end());
+    }
+    CHECK(Joined.size() >= Whole.size());
+    Joined.resize(Whole.size());
+    CHECK(Joined == Whole);
+    return;
+}
+
+static void TestPcmSegmentsAtTheEnds()
+{
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, MakeSplitFrameFile(3));
+    const unsigned int Frames = Gen.GetFrameCount();
+
+    // More warm-up than there are frames before the start, and a range past the end
+    CHECK(ReadTestPcmSegment(Gen, 1, 3, 8) == ReadTestPcmSegment(Gen, 1, 3, 1));
+    CHECK(ReadTestPcmSegment(Gen, Frames - 1, Frames + 5, 8).size() == 1152 * 2);
+    CHECK(ReadTestPcmSegment(Gen, Frames, Frames + 5, 8).empty());
+    return;
+}
+
+/// Put Fr through elGenerator and back through elParser.
+static elFrame RoundTripTestFrame(const elFrame& Fr)
+{
+    elGenerator Gen;
+    Gen.AddFrameFromStream(Fr);
+    elBlock Block;
+    Gen.Generate(Block, false);
+
+    elParser Parser;
+    elStreamVector Streams;
+    bsBitstream IS(Block.Data.get(), Block.Size);
+    Parser.Parse(Streams, IS, Block.Data);
+    CHECK(Streams.size() == 1 && Streams[0].size() == 1);
+    return Streams.empty() || Streams[0].empty() ? elFrame() : Streams[0][0];
+}
+
+static void TestChannelInfoRoundTrip()
+{
+    const elGranule Empty;
+    CHECK(Empty.ChannelInfo[0].Scfsi == 0 && Empty.ChannelInfo[0].Size == 0);
+    CHECK(Empty.ChannelInfo[1].Scfsi == 0 && Empty.ChannelInfo[1].Size == 0);
+
+    // The second granule of an MPEG-1 frame has scfsi too
+    elFrame Fr = MakeTestFrame(7);
+    Fr.Gr[1].ChannelInfo[0].Scfsi = 0x9;
+    Fr.Gr[1].ChannelInfo[1].Scfsi = 0x6;
+    Fr.Gr[0].ChannelInfo[1].SideInfo[0] = 0xDEADBEEF;
+    Fr.Gr[0].ChannelInfo[1].SideInfo[1] = 0x7FFF;
+
+    const elFrame Parsed = RoundTripTestFrame(Fr);
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        CHECK(Parsed.Gr[i].Channels == 2);
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            const elChannelInfo& Expected = Fr.Gr[i].ChannelInfo[j];
+            const elChannelInfo& Info = Parsed.Gr[i].ChannelInfo[j];
+            CHECK(Info.Scfsi == Expected.Scfsi && Info.Size == Expected.Size);
+            CHECK(Info.SideInfo[0] == Expected.SideInfo[0] && Info.SideInfo[1] == Expected.SideInfo[1]);
+        }
+    }
+    return;
+}
+
+static void TestChannelInfoMono()
+{
+    // A mono frame only has the first channel, and the second is left as it was made
+    elFrame Fr = MakeTestFrame(3, 256);
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        Fr.Gr[i].ChannelMode = CM_MONO;
+        Fr.Gr[i].Channels = 1;
+        Fr.Gr[i].ChannelInfo[0].Size = 512;
+        Fr.Gr[i].ChannelInfo[0].Scfsi = i ? 0xF : 0;
+        Fr.Gr[i].ChannelInfo[1] = elChannelInfo();
+    }
+
+    const elFrame Parsed = RoundTripTestFrame(Fr);
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        const elGranule& Gr = Parsed.Gr[i];
+        CHECK(Gr.Channels == 1 && Gr.DataSizeBits == 512);
+        CHECK(Gr.ChannelInfo[0].Size == 512 && Gr.ChannelInfo[0].Scfsi == (i ? 0xFu : 0u));
+        CHECK(Gr.ChannelInfo[0].SideInfo[0] == 3);
+        CHECK(Gr.ChannelInfo[1].Size == 0 && Gr.ChannelInfo[1].Scfsi == 0);
+    }
+    return;
+}
+
+/// Give a granule Count stereo sample frames of uncompressed samples starting at First.
+static void AddTestUncSamples(elGranule& Gr, unsigned int Count, short First)
+{
+    Gr.Uncomp.Count = Count;
+    Gr.Uncomp.OffsetInOutput = 0;
+    Gr.Uncomp.Data = shared_array<short>(new short[Count * 2]);
+    for (unsigned int i = 0; i < Count * 2; i++)
+    {
+        Gr.Uncomp.Data[i] = (short)(First + i);
+    }
+    return;
+}
+
+static void TestFrameSwap()
+{
+    elFrame A = MakeTestFrame(1);
+    elFrame B = MakeTestFrame(2, 64);
+    AddTestUncSamples(A.Gr[1], 10, 100);
+    B.Gr[0].Used = false;
+    const shared_array<uint8_t> DataA = A.Gr[0].Data;
+    const shared_array<short> SamplesA = A.Gr[1].Uncomp.Data;
+    const long UseCount = DataA.use_count();
+
+    // Everything changes places, and the buffers only change hands
+    A.Swap(B);
+    CHECK(GetTestFrameNumber(A.Gr[0]) == 2 && GetTestFrameNumber(B.Gr[1]) == 1);
+    CHECK(!A.Gr[0].Used && B.Gr[0].Used);
+    CHECK(A.Gr[0].DataSizeBits == 128 && B.Gr[0].DataSizeBits == 256);
+    CHECK(B.Gr[0].Data == DataA && DataA.use_count() == UseCount);
+    CHECK(B.Gr[1].Uncomp.Data == SamplesA && B.Gr[1].Uncomp.Count == 10);
+    CHECK(!A.Gr[1].Uncomp.Data && A.Gr[1].Uncomp.Count == 0);
+
+    // The free swap() is the same thing
+    swap(A, B);
+    CHECK(A.Gr[0].Data == DataA && A.Gr[1].Uncomp.Data == SamplesA);
+    return;
+}
+
+static void TestUncSamplesThroughParsing()
+{
+    // Frame 1 has a whole granule of uncompressed samples, frame 2 a few
+    elGenerator Generator;
+    std::vector<uint8_t> Bytes;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        elFrame Fr = MakeTestFrame(i);
+        if (i == 1)
+        {
+            AddTestUncSamples(Fr.Gr[1], 576, 1000);
+        }
+        if (i == 2)
+        {
+            AddTestUncSamples(Fr.Gr[0], 5, -50);
+        }
+        Generator.AddFrameFromStream(Fr);
+
+        elBlock Block;
+        Generator.Generate(Block, false);
+        Bytes.insert(Bytes.end(), Block.Data.get(), Block.Data.get() + Block.Size);
+    }
+    const elBlock Block = MakeTestBlock(Bytes, 4 * 1152);
+
+    // They come out of the generator with the MPEG frames, after the info frame
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, std::vector<elBlock>(1, Block));
+    const elUncompressedSampleFrames& Whole = Gen.ReadUncSamples(1, 2);
+    const elUncompressedSampleFrames& Few = Gen.ReadUncSamples(0, 3);
+    CHECK(Whole.Count == 576 && Whole.Data && Whole.Data[0] == 1000 && Whole.Data[1151] == 1000 + 1151);
+    CHECK(Few.Count == 5 && Few.Data && Few.Data[0] == -50 && Few.Data[9] == -41);
+    CHECK(Gen.ReadUncSamples(0, 2).Count == 0 && Gen.ReadUncSamples(1, 3).Count == 0);
+    return;
+}
+
+static void TestRingBufferWraparound()
+{
+    // Keep the ring at around 10 items so that the head goes round the slots many times
+    elRingBuffer<unsigned int> Ring;
+    unsigned int Next = 0;
+    unsigned int Front = 0;
+    for (unsigned int i = 0; i < 100; i++)
+    {
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            Ring.push_back(Next++);
+        }
+        Ring.pop_front(Ring.size() > 10 ? 3 : 1);
+        Front = Next - Ring.size();
+        for (unsigned int j = 0; j < Ring.size(); j++)
+        {
+            CHECK(Ring[j] == Front + j);
+        }
+    }
+    CHECK(Ring.capacity() == RING_BUFFER_MIN_CAPACITY);
+
+    // Growing while wrapped around keeps the order
+    while (Ring.size() < 100)
+    {
+        Ring.push_back(Next++);
+    }
+    CHECK(Ring.capacity() == 128);
+    for (unsigned int j = 0; j < Ring.size(); j++)
+    {
+        CHECK(Ring[j] == Front + j);
+    }
+    CHECK(Ring.front() == Front && Ring.back() == Next - 1);
+    return;
+}
+
+static void TestRingBufferReleasesItems()
+{
+    // Removed items don't keep what they point to alive
+    shared_ptr<int> Item = make_shared<int>(5);
+    elRingBuffer< shared_ptr<int> > Ring;
+    for (unsigned int i = 0; i < 20; i++)
+    {
+        Ring.push_back(Item);
+    }
+    CHECK(Item.use_count() == 21);
+    Ring.pop_front(5);
+    CHECK(Item.use_count() == 16);
+    Ring.resize(10);
+    CHECK(Item.use_count() == 11);
+
+    // Reused slots start out empty, after a clear too
+    Ring.clear();
+    CHECK(Item.use_count() == 1 && Ring.empty() && Ring.capacity() == 32);
+    Ring.resize(3);
+    CHECK(!Ring[0] && !Ring[2] && !Ring.push_back());
+    return;
+}
+
+/// Get the flags of the Xing header in the info frame at the start of an MP3 file.
+static uint32_t GetTestXingFlags(const std::vector<uint8_t>& Bytes)
+{
+    const uint8_t Tag[] = {'X', 'i', 'n', 'g'};
+    std::vector<uint8_t>::const_iterator Iter = std::search(Bytes.begin(), Bytes.end(), Tag, Tag + 4);
+    CHECK(Iter != Bytes.end() && Iter - Bytes.begin() < 64);
+    if (Bytes.end() - Iter < 8)
+    {
+        return 0xFFFFFFFF;
+    }
+    return Iter[4] << 24 | Iter[5] << 16 | Iter[6] << 8 | Iter[7];
+}
+
+static void TestStdoutStreamingInfoFrame()
+{
+    const std::string Directory = "ealayer3-selftest-stdout";
+    boost::filesystem::remove_all(Directory);
+    boost::filesystem::create_directory(Directory);
+    const std::vector<elBlock> Blocks = MakeSplitFrameFile(6);
+    WriteHeaderlessTestFile(Directory + "/in.bin", Blocks);
+
+    elFileDecoder Decoder;
+    Decoder.SetInput(Directory + "/in.bin");
+    Decoder.SetParser(elFileDecoder::P_VERSION5);
+    Decoder.SetOutput(elFileDecoder::STDOUT_FILENAME, elFileDecoder::F_MP3);
+    Decoder.SetStreaming(true);
+    std::stringstream Output;
+    ProcessToTestStdout(Decoder, Output);
+
+    // The info frame can't be patched in a pipe, so it doesn't claim any frame or byte counts
+    const std::string Written = Output.str();
+    const std::vector<uint8_t> Streamed(Written.begin(), Written.end());
+    const std::vector<uint8_t> Expected = MakeTestMp3(Blocks, 0);
+    CHECK(GetTestXingFlags(Expected) == 3);
+    CHECK(GetTestXingFlags(Streamed) == 0);
+
+    // The frames after it are the same
+    elMpegGenerator Gen;
+    ParseTestBlocks(Gen, Blocks);
+    uint8_t Frame[MAX_MPEG_FRAME_BUFFER];
+    const unsigned int InfoSize = Gen.ReadFrame(Frame, sizeof(Frame), 0);
+    CHECK(Streamed.size() == Expected.size());
+    CHECK(std::equal(Expected.begin() + InfoSize, Expected.end(), Streamed.begin() + InfoSize));
+    boost::filesystem::remove_all(Directory);
+    return;
+}
+
+struct elSelfTest
+{
+    const char* Name;
+    void (*Run)();
+};
+
+static const elSelfTest g_SelfTests[] =
+{
+    {"split frame fragments", TestSplitFrameFragments},
+    {"split frame without its start", TestSplitFrameWithoutStart},
+    {"range starting in the middle of a frame", TestRangeStartingMidFrame},
+    {"range after skipped blocks", TestRangeAfterSkippedBlocks},
+    {"index seek to the middle of a frame", TestIndexSeekMidFrame},
+    {"stale index", TestStaleIndex},
+    {"PCM read fills the buffer", TestPcmReadFillsBuffer},
+    {"PCM read of less than a frame", TestPcmReadLessThanAFrame},
+    {"interleave stereo streams", TestInterleaveStereoStreams},
+    {"interleave mixed streams", TestInterleaveMixedStreams},
+    {"streaming with a long run of borrowing frames", TestStreamingLongBorrowing},
+    {"streaming with a short look-ahead", TestStreamingShortLookAhead},
+    {"parser fallback", TestParserFallback},
+    {"parser fallback without a runner-up", TestParserFallbackWithoutRunnerUp},
+    {"frame arena", TestFrameArena},
+    {"frame arena discard", TestFrameArenaDiscard},
+    {"granules point into the block", TestGranulesPointIntoBlock},
+    {"granules keep the block alive", TestGranulesKeepBlockAlive},
+    {"bit reader matches bsBitstream", TestBitReaderMatchesBitstream},
+    {"bit reader past the end", TestBitReaderPastTheEnd},
+    {"bit writer matches bsBitstream", TestBitWriterMatchesBitstream},
+    {"bit writer keeps the bits around it", TestBitWriterKeepsSurroundingBits},
+    {"bit copy matches a bit by bit copy", TestCopyBitsMatchesBitByBit},
+    {"bit copy of 0 and 1 bits", TestCopyBitsEdges},
+    {"mapped input stream", TestMappedInputStream},
+    {"mapped input stream past the end", TestMappedInputStreamEdges},
+    {"SCx loader skips chunks", TestScxLoaderSkipsChunks},
+    {"SCx loader with a truncated block", TestScxLoaderTruncatedBlock},
+    {"batch decoder", TestBatchDecoder},
+    {"batch decoder with a bad file", TestBatchDecoderFailure},
+    {"streams written in parallel", TestParallelStreamOutputs},
+    {"bounded queue", TestBoundedQueue},
+    {"pipeline matches serial parsing", TestPipelineMatchesSerial},
+    {"pipeline with a writer stage", TestPipelineWriterStage},
+    {"parser probe", TestParserProbe},
+    {"parser probe stops early", TestParserProbeStopsEarly},
+    {"loader selection", TestLoaderSelection},
+    {"loader selection of a short input", TestLoaderSelectionShortInput},
+    {"output to stdout", TestStdoutOutput},
+    {"output of two streams to stdout", TestStdoutOutputManyStreams},
+    {"input from stdin", TestStdinInput},
+    {"input of two parts from stdin", TestStdinInputParts},
+    {"frames read in runs", TestReadFramesMatchesReadFrame},
+    {"frames read past the end", TestReadFramesPastTheEnd},
+    {"PCM decoded in segments", TestPcmSegments},
+    {"PCM segments at the ends of the stream", TestPcmSegmentsAtTheEnds},
+    {"channel info round trip", TestChannelInfoRoundTrip},
+    {"channel info of a mono frame", TestChannelInfoMono},
+    {"frame swap", TestFrameSwap},
+    {"uncompressed samples through parsing", TestUncSamplesThroughParsing},
+    {"ring buffer wraparound", TestRingBufferWraparound},
+    {"ring buffer releases items", TestRingBufferReleasesItems},
+    {"streamed output to stdout", TestStdoutStreamingInfoFrame}
+};
+
+/// Run the built in tests, which don't need any input files.
+static int RunSelfTests()
+{
+    unsigned int Failed = 0;
+    for (unsigned int i = 0; i < sizeof(g_SelfTests) / sizeof(g_SelfTests[0]); i++)
+    {
+        std::cout << "Test: " << g_SelfTests[i].Name << std::endl;
+        const unsigned int FailedChecks = g_FailedChecks;
+        try
+        {
+            g_SelfTests[i].Run();
+        }
+        catch (std::exception& E)
+        {
+            std::cout << "    Exception: " << E.what() << std::endl;
+            g_FailedChecks++;
+        }
+        if (g_FailedChecks != FailedChecks)
+        {
+            Failed++;
+        }
+    }
+    std::cout << Failed << " of " << sizeof(g_SelfTests) / sizeof(g_SelfTests[0]) << " tests failed." << std::endl;
+    return Failed ? 1 : 0;
+}
+
 int main(int Argc, char **Argv)
 {
     // Show a small banner.
@@ -27,10 +1955,14 @@ int main(int Argc, char **Argv)
     // Check the arguments.
     if (Argc != 2)
     {
-        std::cout << "Invalid argument(s). Call with input file name as the only argument." << std::endl;
+        std::cout << "Invalid argument(s). Call with input file name or --self-test as the only argument." << std::endl;
         std::cout << std::endl;
         return 1;
     }
+    if (std::string(Argv[1]) == "--self-test")
+    {
+        return RunSelfTests();
+    }
     const std::string InputFilename = Argv[1];
 
     // Open the input file.